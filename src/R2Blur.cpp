@@ -0,0 +1,667 @@
+// Source file for vectorized separable Gaussian blur
+
+
+
+// Include files
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <assert.h>
+#include <cmath>
+#include <vector>
+#include "R2Blur.h"
+#include "R2BufferPool.h"
+
+// SSE2 is part of every x86-64 target. AVX2 code is compiled with per-function
+// target attributes (GCC/Clang) and only called when the CPU reports it.
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#  define R2_BLUR_HAVE_SSE2
+#  include <emmintrin.h>
+#endif
+#if defined(R2_BLUR_HAVE_SSE2) && defined(__GNUC__)
+#  define R2_BLUR_HAVE_AVX2
+#  include <immintrin.h>
+#endif
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Row kernels
+////////////////////////////////////////////////////////////////////////
+
+// Each instruction set provides two row kernels. kernel is centered
+// (kernel[a] for a in [-reach, reach]) and already normalized.
+//   AcrossRows: out[i] = scale * sum(kernel[a] * center[a * stride + i]) for a in [lo, hi), i in [0, n)
+//   AlongRow:   out[i] = sum(kernel[a] * in[i + a]) for all taps, i in [begin, end)
+typedef void (*AcrossRowsFunction)(const float *center, int stride, int lo, int hi, const float *kernel, float scale, float *out, int n, bool clamped);
+typedef void (*AlongRowFunction)(const float *in, float *out, int begin, int end, const float *kernel, int reach, bool clamped);
+
+
+
+static inline float
+ClampValue(float v)
+{
+  // Clamp to [0, 1] like R2Pixel::Clamp
+  if (v > 1) v = 1;
+  if (v < 0) v = 0;
+  return v;
+}
+
+
+
+static void
+AcrossRowsScalar(const float *center, int stride, int lo, int hi, const float *kernel, float scale, float *out, int n, bool clamped)
+{
+  // Accumulate whole rows so memory is walked contiguously
+  const float *in = &center[lo * stride];
+  for (int i = 0; i < n; i++) out[i] = kernel[lo] * in[i];
+  for (int a = lo + 1; a < hi; a++) {
+    const float k = kernel[a];
+    in = &center[a * stride];
+    for (int i = 0; i < n; i++) out[i] += k * in[i];
+  }
+  for (int i = 0; i < n; i++) {
+    const float v = out[i] * scale;
+    out[i] = (clamped) ? ClampValue(v) : v;
+  }
+}
+
+
+
+static void
+AlongRowScalar(const float *in, float *out, int begin, int end, const float *kernel, int reach, bool clamped)
+{
+  // Full kernel at every position
+  for (int i = begin; i < end; i++) {
+    float sum = 0;
+    for (int a = -reach; a <= reach; a++) sum += kernel[a] * in[i + a];
+    out[i] = (clamped) ? ClampValue(sum) : sum;
+  }
+}
+
+
+
+#ifdef R2_BLUR_HAVE_SSE2
+
+static void
+AcrossRowsSSE2(const float *center, int stride, int lo, int hi, const float *kernel, float scale, float *out, int n, bool clamped)
+{
+  // Same as AcrossRowsScalar, four floats at a time
+  const int n4 = n & ~3;
+  const float *in = &center[lo * stride];
+  __m128 k = _mm_set1_ps(kernel[lo]);
+  for (int i = 0; i < n4; i += 4) _mm_storeu_ps(&out[i], _mm_mul_ps(k, _mm_loadu_ps(&in[i])));
+  for (int i = n4; i < n; i++) out[i] = kernel[lo] * in[i];
+  for (int a = lo + 1; a < hi; a++) {
+    k = _mm_set1_ps(kernel[a]);
+    in = &center[a * stride];
+    for (int i = 0; i < n4; i += 4) {
+      _mm_storeu_ps(&out[i], _mm_add_ps(_mm_loadu_ps(&out[i]), _mm_mul_ps(k, _mm_loadu_ps(&in[i]))));
+    }
+    for (int i = n4; i < n; i++) out[i] += kernel[a] * in[i];
+  }
+
+  const __m128 s = _mm_set1_ps(scale);
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 one = _mm_set1_ps(1.0f);
+  for (int i = 0; i < n4; i += 4) {
+    __m128 v = _mm_mul_ps(_mm_loadu_ps(&out[i]), s);
+    if (clamped) v = _mm_min_ps(_mm_max_ps(v, zero), one);
+    _mm_storeu_ps(&out[i], v);
+  }
+  for (int i = n4; i < n; i++) {
+    const float v = out[i] * scale;
+    out[i] = (clamped) ? ClampValue(v) : v;
+  }
+}
+
+
+
+static void
+AlongRowSSE2(const float *in, float *out, int begin, int end, const float *kernel, int reach, bool clamped)
+{
+  // Four neighboring outputs at a time from unaligned loads of the input
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 one = _mm_set1_ps(1.0f);
+  int i = begin;
+  for (; i + 4 <= end; i += 4) {
+    __m128 sum = _mm_setzero_ps();
+    for (int a = -reach; a <= reach; a++) {
+      sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(kernel[a]), _mm_loadu_ps(&in[i + a])));
+    }
+    if (clamped) sum = _mm_min_ps(_mm_max_ps(sum, zero), one);
+    _mm_storeu_ps(&out[i], sum);
+  }
+  AlongRowScalar(in, out, i, end, kernel, reach, clamped);
+}
+
+#endif
+
+
+
+#ifdef R2_BLUR_HAVE_AVX2
+
+__attribute__((target("avx2,fma")))
+static void
+AcrossRowsAVX2(const float *center, int stride, int lo, int hi, const float *kernel, float scale, float *out, int n, bool clamped)
+{
+  // Same as AcrossRowsScalar, eight floats at a time with fused multiply-add
+  const int n8 = n & ~7;
+  const float *in = &center[lo * stride];
+  __m256 k = _mm256_set1_ps(kernel[lo]);
+  for (int i = 0; i < n8; i += 8) _mm256_storeu_ps(&out[i], _mm256_mul_ps(k, _mm256_loadu_ps(&in[i])));
+  for (int i = n8; i < n; i++) out[i] = kernel[lo] * in[i];
+  for (int a = lo + 1; a < hi; a++) {
+    k = _mm256_set1_ps(kernel[a]);
+    in = &center[a * stride];
+    for (int i = 0; i < n8; i += 8) {
+      _mm256_storeu_ps(&out[i], _mm256_fmadd_ps(k, _mm256_loadu_ps(&in[i]), _mm256_loadu_ps(&out[i])));
+    }
+    for (int i = n8; i < n; i++) out[i] += kernel[a] * in[i];
+  }
+
+  const __m256 s = _mm256_set1_ps(scale);
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256 one = _mm256_set1_ps(1.0f);
+  for (int i = 0; i < n8; i += 8) {
+    __m256 v = _mm256_mul_ps(_mm256_loadu_ps(&out[i]), s);
+    if (clamped) v = _mm256_min_ps(_mm256_max_ps(v, zero), one);
+    _mm256_storeu_ps(&out[i], v);
+  }
+  for (int i = n8; i < n; i++) {
+    const float v = out[i] * scale;
+    out[i] = (clamped) ? ClampValue(v) : v;
+  }
+}
+
+
+
+__attribute__((target("avx2,fma")))
+static void
+AlongRowAVX2(const float *in, float *out, int begin, int end, const float *kernel, int reach, bool clamped)
+{
+  // Eight neighboring outputs at a time from unaligned loads of the input
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256 one = _mm256_set1_ps(1.0f);
+  int i = begin;
+  for (; i + 8 <= end; i += 8) {
+    __m256 sum = _mm256_setzero_ps();
+    for (int a = -reach; a <= reach; a++) {
+      sum = _mm256_fmadd_ps(_mm256_set1_ps(kernel[a]), _mm256_loadu_ps(&in[i + a]), sum);
+    }
+    if (clamped) sum = _mm256_min_ps(_mm256_max_ps(sum, zero), one);
+    _mm256_storeu_ps(&out[i], sum);
+  }
+  AlongRowScalar(in, out, i, end, kernel, reach, clamped);
+}
+
+#endif
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Dispatch
+////////////////////////////////////////////////////////////////////////
+
+static R2BlurInstructionSet
+BestInstructionSet(void)
+{
+  // Best instruction set this build and CPU support
+#ifdef R2_BLUR_HAVE_AVX2
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return R2_BLUR_AVX2;
+#endif
+#ifdef R2_BLUR_HAVE_SSE2
+  return R2_BLUR_SSE2;
+#else
+  return R2_BLUR_SCALAR;
+#endif
+}
+
+
+
+static R2BlurInstructionSet&
+CurrentInstructionSet(void)
+{
+  // Selected instruction set, initialized on first use
+  static R2BlurInstructionSet instructionSet = BestInstructionSet();
+  return instructionSet;
+}
+
+
+
+R2BlurInstructionSet
+R2BlurGetInstructionSet(void)
+{
+  // Return selected instruction set
+  return CurrentInstructionSet();
+}
+
+
+
+void
+R2BlurSetInstructionSet(R2BlurInstructionSet instructionSet)
+{
+  // Select instruction set, never above what the CPU supports
+  const R2BlurInstructionSet best = BestInstructionSet();
+  CurrentInstructionSet() = (instructionSet < best) ? instructionSet : best;
+}
+
+
+
+const char *
+R2BlurInstructionSetName(R2BlurInstructionSet instructionSet)
+{
+  // Return printable name
+  switch (instructionSet) {
+  case R2_BLUR_SCALAR: return "scalar";
+  case R2_BLUR_SSE2: return "SSE2";
+  case R2_BLUR_AVX2: return "AVX2";
+  default: return "unknown";
+  }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Blur
+////////////////////////////////////////////////////////////////////////
+
+static void
+SelectRowKernels(AcrossRowsFunction& acrossRows, AlongRowFunction& alongRow)
+{
+  // Row kernels of the selected instruction set
+  acrossRows = AcrossRowsScalar;
+  alongRow = AlongRowScalar;
+  switch (R2BlurGetInstructionSet()) {
+#ifdef R2_BLUR_HAVE_AVX2
+  case R2_BLUR_AVX2: acrossRows = AcrossRowsAVX2; alongRow = AlongRowAVX2; break;
+#endif
+#ifdef R2_BLUR_HAVE_SSE2
+  case R2_BLUR_SSE2: acrossRows = AcrossRowsSSE2; alongRow = AlongRowSSE2; break;
+#endif
+  default: break;
+  }
+}
+
+
+
+static void
+BorderColumns(const float *in, float *out, int begin, int end, int width, const float *kernel, int reach, const float *scales, bool clamped)
+{
+  // Truncated kernel at positions [begin, end) of a row, renormalized
+  for (int i = begin; i < end; i++) {
+    const int lo = (i - reach < 0) ? -i : -reach;
+    const int hi = (i + reach + 1 > width) ? width - i : reach + 1;
+    float sum = 0;
+    for (int a = lo; a < hi; a++) sum += kernel[a] * in[i + a];
+    sum *= scales[i];
+    out[i] = (clamped) ? ClampValue(sum) : sum;
+  }
+}
+
+
+
+static void
+AlongRow(AlongRowFunction alongRow, const float *in, float *out, int width, const float *kernel, int reach, const float *scales, bool clamped)
+{
+  // Vectorized interior, renormalized borders
+  const int begin = (reach < width) ? reach : width;
+  const int end = (width - reach > begin) ? width - reach : begin;
+  BorderColumns(in, out, 0, begin, width, kernel, reach, scales, clamped);
+  BorderColumns(in, out, end, width, width, kernel, reach, scales, clamped);
+  alongRow(in, out, begin, end, kernel, reach, clamped);
+}
+
+
+
+void
+R2BlurBorderScales(const float *kernel, int reach, int n, float *scales)
+{
+  // 1 / (sum of the taps inside [0, n)) for every position along a line
+  for (int p = 0; p < n; p++) {
+    const int lo = (p - reach < 0) ? -p : -reach;
+    const int hi = (p + reach + 1 > n) ? n - p : reach + 1;
+    float weightSum = 0;
+    for (int a = lo; a < hi; a++) weightSum += kernel[a];
+    scales[p] = 1.0f / weightSum;
+  }
+}
+
+
+
+void
+R2BlurAcrossRows(const float *center, int stride, int lo, int hi, const float *kernel, float scale, float *out, int n, bool clamped)
+{
+  // One output row from rows center + a * stride, a in [lo, hi)
+  AcrossRowsFunction acrossRows;
+  AlongRowFunction alongRow;
+  SelectRowKernels(acrossRows, alongRow);
+  acrossRows(center, stride, lo, hi, kernel, scale, out, n, clamped);
+}
+
+
+
+void
+R2BlurAlongRow(const float *in, float *out, int width, const float *kernel, int reach, const float *scales, bool clamped)
+{
+  // One row blurred horizontally
+  AcrossRowsFunction acrossRows;
+  AlongRowFunction alongRow;
+  SelectRowKernels(acrossRows, alongRow);
+  AlongRow(alongRow, in, out, width, kernel, reach, scales, clamped);
+}
+
+
+
+void
+R2BlurPlane(float *plane, float *temp, int width, int height, int stride, const float *kernel, int reach, bool clamped)
+{
+  // Pick row kernels
+  AcrossRowsFunction acrossRows;
+  AlongRowFunction alongRow;
+  SelectRowKernels(acrossRows, alongRow);
+
+  // Normalize kernel once, and precompute the renormalization of every border position
+  R2BufferPool& pool = R2BufferPool::ThreadPool();
+  const int taps = 2 * reach + 1;
+  float *normalized = (float *) pool.Allocate(taps * sizeof(float));
+  float kernelSum = 0;
+  for (int a = 0; a < taps; a++) kernelSum += kernel[a];
+  for (int a = 0; a < taps; a++) normalized[a] = kernel[a] / kernelSum;
+  const float *k = &normalized[reach];
+  float *rowScales = (float *) pool.Allocate(height * sizeof(float));
+  float *columnScales = (float *) pool.Allocate(width * sizeof(float));
+  R2BlurBorderScales(k, reach, height, rowScales);
+  R2BlurBorderScales(k, reach, width, columnScales);
+
+  // Vertical pass into temp (interior rows need no renormalization)
+  for (int j = 0; j < height; j++) {
+    const int lo = (j - reach < 0) ? -j : -reach;
+    const int hi = (j + reach + 1 > height) ? height - j : reach + 1;
+    const float scale = ((lo == -reach) && (hi == reach + 1)) ? 1.0f : rowScales[j];
+    acrossRows(&plane[j * stride], stride, lo, hi, k, scale, &temp[j * stride], width, clamped);
+  }
+
+  // Horizontal pass back into plane
+  for (int j = 0; j < height; j++) {
+    AlongRow(alongRow, &temp[j * stride], &plane[j * stride], width, k, reach, columnScales, clamped);
+  }
+
+  pool.Release(normalized, taps * sizeof(float));
+  pool.Release(rowScales, height * sizeof(float));
+  pool.Release(columnScales, width * sizeof(float));
+}
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Recursive blur
+////////////////////////////////////////////////////////////////////////
+
+// Young-van Vliet recursive Gaussian: a causal pass
+//   w[n] = b * x[n] + a1 * w[n-1] + a2 * w[n-2] + a3 * w[n-3]
+// followed by the same recursion run anticausally over w. Cost per pixel is
+// fixed whatever sigma is. Lines are extended with zeros (the anticausal pass
+// starts from the Triggs-Sdika state matrix m applied to the last causal
+// outputs) and the result divided by the blur of a line of ones, which is the
+// same border renormalization R2BlurPlane does with its truncated kernel.
+struct RecursiveCoefficients {
+  float b, a1, a2, a3;
+  float m[3][3];
+};
+
+
+
+static double&
+RecursiveSigmaThreshold(void)
+{
+  // Smallest sigma blurred recursively, initialized on first use
+  static double sigma = R2_BLUR_DEFAULT_RECURSIVE_SIGMA;
+  return sigma;
+}
+
+
+
+double
+R2BlurGetRecursiveSigma(void)
+{
+  // Return threshold
+  return RecursiveSigmaThreshold();
+}
+
+
+
+void
+R2BlurSetRecursiveSigma(double sigma)
+{
+  // Set threshold (a huge value disables the recursive filter)
+  RecursiveSigmaThreshold() = sigma;
+}
+
+
+
+static void
+ComputeRecursiveCoefficients(double sigma, RecursiveCoefficients& c)
+{
+  // Young and van Vliet (1995) fit of q to sigma, then the pole polynomial
+  const double q = (sigma >= 2.5) ? 0.98711 * sigma - 0.96330 : 3.97156 - 4.14554 * sqrt(1 - 0.26891 * sigma);
+  const double q2 = q * q;
+  const double q3 = q2 * q;
+  const double b0 = 1.57825 + 2.44413 * q + 1.4281 * q2 + 0.422205 * q3;
+  const double a1 = (2.44413 * q + 2.85619 * q2 + 1.26661 * q3) / b0;
+  const double a2 = -(1.4281 * q2 + 1.26661 * q3) / b0;
+  const double a3 = (0.422205 * q3) / b0;
+  const double b = 1 - (a1 + a2 + a3);
+
+  // Anticausal start state past the end of a line, as a linear map of the last
+  // three causal outputs: run the causal pass on into the zero extension from
+  // each unit state, then the anticausal pass back
+  const int length = 10 * (int) sigma + 50;
+  std::vector<double> d(length + 3), e(length + 3);
+  for (int k = 0; k < 3; k++) {
+    double s1 = (k == 0) ? 1 : 0, s2 = (k == 1) ? 1 : 0, s3 = (k == 2) ? 1 : 0;
+    for (int n = 0; n < length; n++) {
+      d[n] = a1 * s1 + a2 * s2 + a3 * s3;
+      s3 = s2; s2 = s1; s1 = d[n];
+    }
+    e[length] = e[length + 1] = e[length + 2] = 0;
+    for (int n = length - 1; n >= 0; n--) {
+      e[n] = b * d[n] + a1 * e[n + 1] + a2 * e[n + 2] + a3 * e[n + 3];
+    }
+    for (int r = 0; r < 3; r++) c.m[r][k] = (float) e[r];
+  }
+
+  c.b = (float) b;
+  c.a1 = (float) a1;
+  c.a2 = (float) a2;
+  c.a3 = (float) a3;
+}
+
+
+
+static void
+RecursiveRows(const float *in, const float *p1, const float *p2, const float *p3, const RecursiveCoefficients& c, float *out, int n)
+{
+  // out = b * in + a1 * p1 + a2 * p2 + a3 * p3 over whole rows
+  int i = 0;
+#ifdef R2_BLUR_HAVE_SSE2
+  const __m128 b = _mm_set1_ps(c.b);
+  const __m128 a1 = _mm_set1_ps(c.a1);
+  const __m128 a2 = _mm_set1_ps(c.a2);
+  const __m128 a3 = _mm_set1_ps(c.a3);
+  if (R2BlurGetInstructionSet() != R2_BLUR_SCALAR) {
+    for (; i + 4 <= n; i += 4) {
+      __m128 v = _mm_mul_ps(b, _mm_loadu_ps(&in[i]));
+      v = _mm_add_ps(v, _mm_mul_ps(a1, _mm_loadu_ps(&p1[i])));
+      v = _mm_add_ps(v, _mm_mul_ps(a2, _mm_loadu_ps(&p2[i])));
+      v = _mm_add_ps(v, _mm_mul_ps(a3, _mm_loadu_ps(&p3[i])));
+      _mm_storeu_ps(&out[i], v);
+    }
+  }
+#endif
+  for (; i < n; i++) out[i] = c.b * in[i] + c.a1 * p1[i] + c.a2 * p2[i] + c.a3 * p3[i];
+}
+
+
+
+static void
+RecursiveLine(float *line, int n, const RecursiveCoefficients& c)
+{
+  // Causal then anticausal pass along one contiguous line, in place
+  float s1 = 0, s2 = 0, s3 = 0;
+  for (int i = 0; i < n; i++) {
+    const float w = c.b * line[i] + c.a1 * s1 + c.a2 * s2 + c.a3 * s3;
+    s3 = s2; s2 = s1; s1 = w;
+    line[i] = w;
+  }
+
+  const float d1 = s1, d2 = s2, d3 = s3;
+  s1 = c.m[0][0] * d1 + c.m[0][1] * d2 + c.m[0][2] * d3;
+  s2 = c.m[1][0] * d1 + c.m[1][1] * d2 + c.m[1][2] * d3;
+  s3 = c.m[2][0] * d1 + c.m[2][1] * d2 + c.m[2][2] * d3;
+  for (int i = n - 1; i >= 0; i--) {
+    const float y = c.b * line[i] + c.a1 * s1 + c.a2 * s2 + c.a3 * s3;
+    s3 = s2; s2 = s1; s1 = y;
+    line[i] = y;
+  }
+}
+
+
+
+static void
+RecursiveScales(int n, const RecursiveCoefficients& c, float *scales)
+{
+  // 1 / (blur of a line of n ones) for every position along a line
+  for (int i = 0; i < n; i++) scales[i] = 1;
+  RecursiveLine(scales, n, c);
+  for (int i = 0; i < n; i++) scales[i] = 1.0f / scales[i];
+}
+
+
+
+void
+R2RecursiveBlurPlane(float *plane, float *temp, int width, int height, int stride, double sigma, bool clamped)
+{
+  // Check plane
+  if ((width == 0) || (height == 0)) return;
+  RecursiveCoefficients c;
+  ComputeRecursiveCoefficients(sigma, c);
+
+  // Border renormalization, and three rows of zeros past the bottom
+  R2BufferPool& pool = R2BufferPool::ThreadPool();
+  float *rowScales = (float *) pool.Allocate(height * sizeof(float));
+  float *columnScales = (float *) pool.Allocate(width * sizeof(float));
+  float *edge = (float *) pool.Allocate(3 * (size_t) width * sizeof(float));
+  RecursiveScales(height, c, rowScales);
+  RecursiveScales(width, c, columnScales);
+  for (int i = 0; i < 3 * width; i++) edge[i] = 0;
+
+  // Vertical causal pass into temp, whole rows at a time
+  for (int j = 0; j < height; j++) {
+    const float *p1 = (j >= 1) ? &temp[(j - 1) * stride] : &edge[0];
+    const float *p2 = (j >= 2) ? &temp[(j - 2) * stride] : &edge[width];
+    const float *p3 = (j >= 3) ? &temp[(j - 3) * stride] : &edge[2 * width];
+    RecursiveRows(&plane[j * stride], p1, p2, p3, c, &temp[j * stride], width);
+  }
+
+  // Anticausal start rows past the top, from the last three causal rows
+  const float *w1 = &temp[(height - 1) * stride];
+  for (int i = 0; i < width; i++) {
+    const float d1 = w1[i];
+    const float d2 = (height >= 2) ? w1[i - stride] : 0;
+    const float d3 = (height >= 3) ? w1[i - 2 * stride] : 0;
+    for (int r = 0; r < 3; r++) {
+      edge[r * width + i] = c.m[r][0] * d1 + c.m[r][1] * d2 + c.m[r][2] * d3;
+    }
+  }
+
+  // Vertical anticausal pass back into plane
+  for (int j = height - 1; j >= 0; j--) {
+    const float *p1 = (j + 1 < height) ? &plane[(j + 1) * stride] : &edge[(j + 1 - height) * width];
+    const float *p2 = (j + 2 < height) ? &plane[(j + 2) * stride] : &edge[(j + 2 - height) * width];
+    const float *p3 = (j + 3 < height) ? &plane[(j + 3) * stride] : &edge[(j + 3 - height) * width];
+    RecursiveRows(&temp[j * stride], p1, p2, p3, c, &plane[j * stride], width);
+  }
+
+  // Horizontal passes along every row, renormalizing both directions once the
+  // recursions no longer need the raw outputs
+  for (int j = 0; j < height; j++) {
+    float *row = &plane[j * stride];
+    const float rowScale = rowScales[j];
+    for (int i = 0; i < width; i++) row[i] *= rowScale;
+    RecursiveLine(row, width, c);
+    for (int i = 0; i < width; i++) {
+      const float v = row[i] * columnScales[i];
+      row[i] = (clamped) ? ClampValue(v) : v;
+    }
+  }
+
+  pool.Release(rowScales, height * sizeof(float));
+  pool.Release(columnScales, width * sizeof(float));
+  pool.Release(edge, 3 * (size_t) width * sizeof(float));
+}
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Accuracy report
+////////////////////////////////////////////////////////////////////////
+
+void
+R2BlurPrintAccuracyReport(FILE *fp)
+{
+  // Blur a noise plane (the hardest case for the recursive fit) both ways for
+  // the sigmas Harris is run with, and compare inside and near the borders
+  const int width = 640;
+  const int height = 480;
+  const int stride = width;
+  const size_t planeSize = (size_t) stride * height;
+  std::vector<float> noise(planeSize), fir(planeSize), iir(planeSize), temp(planeSize);
+  srand(1);
+  for (size_t k = 0; k < planeSize; k++) noise[k] = (float) rand() / RAND_MAX;
+
+  fprintf(fp, "Recursive vs kernel blur, %dx%d noise in [0, 1], %s\n", width, height, R2BlurInstructionSetName(R2BlurGetInstructionSet()));
+  fprintf(fp, "%6s %12s %12s %12s %10s %10s\n", "sigma", "inner max", "inner rms", "border max", "fir ms", "iir ms");
+  const double sigmas[] = { 1, 2, 3, 4, 6, 8, 10, 14, 18 };
+  for (unsigned int s = 0; s < sizeof(sigmas) / sizeof(sigmas[0]); s++) {
+    // Kernel sampled like R2PlanarImage::Blur
+    const double sigma = sigmas[s];
+    const int reach = (int) (3 * sigma);
+    std::vector<float> kernel(2 * reach + 1);
+    for (int a = -reach; a <= reach; a++) kernel[a + reach] = (float) exp(-(a * a) / (2.0 * sigma * sigma));
+
+    // Time a few runs of each
+    const int nruns = 5;
+    clock_t begin = clock();
+    for (int r = 0; r < nruns; r++) {
+      fir = noise;
+      R2BlurPlane(fir.data(), temp.data(), width, height, stride, kernel.data(), reach, false);
+    }
+    const double firTime = 1000.0 * (clock() - begin) / CLOCKS_PER_SEC / nruns;
+    begin = clock();
+    for (int r = 0; r < nruns; r++) {
+      iir = noise;
+      R2RecursiveBlurPlane(iir.data(), temp.data(), width, height, stride, sigma, false);
+    }
+    const double iirTime = 1000.0 * (clock() - begin) / CLOCKS_PER_SEC / nruns;
+
+    // Errors more than one kernel reach from every border, and within it
+    double innerMax = 0, innerSum = 0, borderMax = 0;
+    int innerCount = 0;
+    for (int y = 0; y < height; y++) {
+      for (int x = 0; x < width; x++) {
+        const double error = fabs(iir[y * stride + x] - fir[y * stride + x]);
+        if ((x >= reach) && (x < width - reach) && (y >= reach) && (y < height - reach)) {
+          if (error > innerMax) innerMax = error;
+          innerSum += error * error;
+          innerCount++;
+        }
+        else if (error > borderMax) borderMax = error;
+      }
+    }
+    const double innerRms = (innerCount > 0) ? sqrt(innerSum / innerCount) : 0;
+    fprintf(fp, "%6g %12.2e %12.2e %12.2e %10.2f %10.2f\n", sigma, innerMax, innerRms, borderMax, firTime, iirTime);
+  }
+}
@@ -0,0 +1,61 @@
+// Include file for vectorized separable Gaussian blur of float planes
+#ifndef R2_BLUR_INCLUDED
+#define R2_BLUR_INCLUDED
+
+
+
+// Include files
+
+#include <stdio.h>
+
+
+
+// Constant definitions
+
+// Sigma from which R2PlanarImage blurs recursively instead of with a kernel
+#define R2_BLUR_DEFAULT_RECURSIVE_SIGMA 4.0
+
+typedef enum {
+  R2_BLUR_SCALAR,
+  R2_BLUR_SSE2,
+  R2_BLUR_AVX2,
+  R2_BLUR_NUM_INSTRUCTION_SETS
+} R2BlurInstructionSet;
+
+
+
+// Function declarations
+
+// Instruction set R2BlurPlane runs with (the best one the CPU supports unless
+// set lower, requests above what the CPU supports fall back to the best one)
+R2BlurInstructionSet R2BlurGetInstructionSet(void);
+void R2BlurSetInstructionSet(R2BlurInstructionSet instructionSet);
+const char *R2BlurInstructionSetName(R2BlurInstructionSet instructionSet);
+
+// Blur one row-major plane in place with 2 * reach + 1 kernel taps, normalized
+// by the taps that fall inside the plane. temp must hold stride * height floats.
+void R2BlurPlane(float *plane, float *temp, int width, int height, int stride, const float *kernel, int reach, bool clamped);
+
+// Pieces of R2BlurPlane for blurring a band of rows at a time. Here kernel points
+// at the center tap of a normalized kernel. Scales are 1 / (sum of the taps
+// inside the line) per position, as filled in by R2BlurBorderScales.
+// R2BlurAcrossRows sums scale * kernel[a] * center[a * stride + i] over a in [lo, hi).
+void R2BlurBorderScales(const float *kernel, int reach, int n, float *scales);
+void R2BlurAcrossRows(const float *center, int stride, int lo, int hi, const float *kernel, float scale, float *out, int n, bool clamped);
+void R2BlurAlongRow(const float *in, float *out, int width, const float *kernel, int reach, const float *scales, bool clamped);
+
+// Same blur with a recursive (IIR) filter whose cost does not grow with sigma.
+// Lines are extended with zeros and divided by the blur of a line of ones, so
+// borders are renormalized like R2BlurPlane's.
+void R2RecursiveBlurPlane(float *plane, float *temp, int width, int height, int stride, double sigma, bool clamped);
+
+// Smallest sigma R2PlanarImage blurs with R2RecursiveBlurPlane
+double R2BlurGetRecursiveSigma(void);
+void R2BlurSetRecursiveSigma(double sigma);
+
+// Print error and timing of R2RecursiveBlurPlane against R2BlurPlane
+void R2BlurPrintAccuracyReport(FILE *fp);
+
+
+
+#endif
@@ -0,0 +1,217 @@
+// Source file for rotated BRIEF binary descriptors
+
+
+
+// Include files
+
+#include <stdio.h>
+#include <cmath>
+#include <vector>
+#include "R2PlanarImage.h"
+#include "R2Brief.h"
+
+// The popcount instruction is compiled with a per-function target attribute
+// (GCC/Clang) and only called when the CPU reports it
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  define R2_BRIEF_HAVE_POPCNT
+#endif
+
+// Not M_PI, which MSVC only defines with _USE_MATH_DEFINES
+static const double R2_BRIEF_PI = 3.14159265358979323846;
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Comparison pattern
+////////////////////////////////////////////////////////////////////////
+
+struct BriefPair {
+  float x1, y1;
+  float x2, y2;
+};
+
+
+
+static std::vector<BriefPair>
+MakePattern(void)
+{
+  // Points drawn from an isotropic Gaussian of sigma (2 * radius + 1) / 5 (BRIEF's
+  // best pattern), redrawn outside the radius so they stay within it whatever
+  // the rotation. The generator is fixed so descriptors never change between runs.
+  const double sigma = (2 * R2_BRIEF_RADIUS + 1) / 5.0;
+  unsigned int state = 1;
+  std::vector<float> coordinates;
+  while (coordinates.size() < 4 * R2_BRIEF_BITS) {
+    double u[2];
+    for (int k = 0; k < 2; k++) {
+      state = 1664525 * state + 1013904223;
+      u[k] = ((state >> 8) + 0.5) / 16777216.0;
+    }
+    const double r = sigma * sqrt(-2 * log(u[0]));
+    const double x = r * cos(2 * R2_BRIEF_PI * u[1]);
+    const double y = r * sin(2 * R2_BRIEF_PI * u[1]);
+    if (x * x + y * y > R2_BRIEF_RADIUS * R2_BRIEF_RADIUS) continue;
+    coordinates.push_back(x);
+    coordinates.push_back(y);
+  }
+
+  std::vector<BriefPair> pattern(R2_BRIEF_BITS);
+  for (int i = 0; i < R2_BRIEF_BITS; i++) {
+    BriefPair& pair = pattern[i];
+    pair.x1 = coordinates[4 * i + 0];
+    pair.y1 = coordinates[4 * i + 1];
+    pair.x2 = coordinates[4 * i + 2];
+    pair.y2 = coordinates[4 * i + 3];
+  }
+  return pattern;
+}
+
+
+
+static const std::vector<BriefPair>&
+Pattern(void)
+{
+  // Pattern shared by all descriptors, made on first use
+  static const std::vector<BriefPair> pattern = MakePattern();
+  return pattern;
+}
+
+
+
+static inline float
+Sample(const R2PlanarImage& blurred, int x, int y)
+{
+  // Value of the nearest pixel inside the plane
+  if (x < 0) x = 0;
+  else if (x >= blurred.Width()) x = blurred.Width() - 1;
+  if (y < 0) y = 0;
+  else if (y >= blurred.Height()) y = blurred.Height() - 1;
+  return blurred.Value(0, x, y);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Descriptors
+////////////////////////////////////////////////////////////////////////
+
+double
+R2BriefOrientation(const R2PlanarImage& blurred, int x, int y)
+{
+  // First moments of the disc around (x, y)
+  double m10 = 0, m01 = 0;
+  for (int dy = -R2_BRIEF_RADIUS; dy <= R2_BRIEF_RADIUS; dy++) {
+    for (int dx = -R2_BRIEF_RADIUS; dx <= R2_BRIEF_RADIUS; dx++) {
+      if (dx * dx + dy * dy > R2_BRIEF_RADIUS * R2_BRIEF_RADIUS) continue;
+      const float value = Sample(blurred, x + dx, y + dy);
+      m10 += dx * value;
+      m01 += dy * value;
+    }
+  }
+  return atan2(m01, m10);
+}
+
+
+
+void
+R2BriefCompute(const R2PlanarImage& blurred, int x, int y, double angle, R2BriefDescriptor& descriptor)
+{
+  // Bit i is set when the first point of pair i is darker than the second
+  const std::vector<BriefPair>& pattern = Pattern();
+  const double c = cos(angle);
+  const double s = sin(angle);
+  for (int w = 0; w < R2_BRIEF_WORDS; w++) descriptor.bits[w] = 0;
+  for (int i = 0; i < R2_BRIEF_BITS; i++) {
+    const BriefPair& pair = pattern[i];
+    const int x1 = x + (int) lround(c * pair.x1 - s * pair.y1);
+    const int y1 = y + (int) lround(s * pair.x1 + c * pair.y1);
+    const int x2 = x + (int) lround(c * pair.x2 - s * pair.y2);
+    const int y2 = y + (int) lround(s * pair.x2 + c * pair.y2);
+    if (Sample(blurred, x1, y1) < Sample(blurred, x2, y2)) descriptor.bits[i / 64] |= (uint64_t) 1 << (i % 64);
+  }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Hamming distance
+////////////////////////////////////////////////////////////////////////
+
+typedef void (*DistancesFunction)(const R2BriefDescriptor& descriptor, const R2BriefDescriptor *others, int n, int *distances);
+
+
+
+static inline int
+CountBits(uint64_t word)
+{
+  // Population count without the instruction
+  word = word - ((word >> 1) & 0x5555555555555555ULL);
+  word = (word & 0x3333333333333333ULL) + ((word >> 2) & 0x3333333333333333ULL);
+  word = (word + (word >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+  return (int) ((word * 0x0101010101010101ULL) >> 56);
+}
+
+
+
+static void
+DistancesPortable(const R2BriefDescriptor& descriptor, const R2BriefDescriptor *others, int n, int *distances)
+{
+  // Count differing bits word by word
+  for (int j = 0; j < n; j++) {
+    int distance = 0;
+    for (int w = 0; w < R2_BRIEF_WORDS; w++) distance += CountBits(descriptor.bits[w] ^ others[j].bits[w]);
+    distances[j] = distance;
+  }
+}
+
+
+
+#ifdef R2_BRIEF_HAVE_POPCNT
+
+__attribute__((target("popcnt")))
+static void
+DistancesPopcnt(const R2BriefDescriptor& descriptor, const R2BriefDescriptor *others, int n, int *distances)
+{
+  // Same as DistancesPortable, one popcount instruction per word
+  for (int j = 0; j < n; j++) {
+    int distance = 0;
+    for (int w = 0; w < R2_BRIEF_WORDS; w++) distance += __builtin_popcountll(descriptor.bits[w] ^ others[j].bits[w]);
+    distances[j] = distance;
+  }
+}
+
+#endif
+
+
+
+static DistancesFunction
+SelectDistances(void)
+{
+  // Fastest version the CPU supports
+#ifdef R2_BRIEF_HAVE_POPCNT
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("popcnt")) return DistancesPopcnt;
+#endif
+  return DistancesPortable;
+}
+
+
+
+int
+R2BriefDistance(const R2BriefDescriptor& a, const R2BriefDescriptor& b)
+{
+  // Distance between one pair
+  int distance;
+  R2BriefDistances(a, &b, 1, &distance);
+  return distance;
+}
+
+
+
+void
+R2BriefDistances(const R2BriefDescriptor& descriptor, const R2BriefDescriptor *others, int n, int *distances)
+{
+  // Selected once, on first use
+  static const DistancesFunction distancesFunction = SelectDistances();
+  distancesFunction(descriptor, others, n, distances);
+}
@@ -0,0 +1,51 @@
+// Include file for rotated BRIEF binary descriptors
+#ifndef R2_BRIEF_INCLUDED
+#define R2_BRIEF_INCLUDED
+
+
+
+// Include files
+
+#include <stdint.h>
+
+
+
+// Constant definitions
+
+// 256 comparisons between point pairs within radius 15 of the feature, made on
+// luminance blurred by sigma 2 and rotated to the patch orientation (as in ORB)
+#define R2_BRIEF_BITS 256
+#define R2_BRIEF_WORDS (R2_BRIEF_BITS / 64)
+#define R2_BRIEF_RADIUS 15
+#define R2_BRIEF_SIGMA 2.0
+
+
+
+// Class definition
+
+class R2PlanarImage;
+
+struct R2BriefDescriptor {
+  uint64_t bits[R2_BRIEF_WORDS];
+};
+
+
+
+// Function declarations
+
+// Orientation of the patch around (x, y) of a blurred luminance plane: the angle
+// of its intensity centroid, in radians
+double R2BriefOrientation(const R2PlanarImage& blurred, int x, int y);
+
+// Descriptor of the patch around (x, y) with the comparison pattern rotated by
+// angle. Points outside the plane take the value of the nearest border pixel.
+void R2BriefCompute(const R2PlanarImage& blurred, int x, int y, double angle, R2BriefDescriptor& descriptor);
+
+// Hamming distances from descriptor to each of n others (with the popcount
+// instruction when the CPU has it)
+int R2BriefDistance(const R2BriefDescriptor& a, const R2BriefDescriptor& b);
+void R2BriefDistances(const R2BriefDescriptor& descriptor, const R2BriefDescriptor *others, int n, int *distances);
+
+
+
+#endif
@@ -0,0 +1,178 @@
+// Source file for pixel buffer pool class
+
+
+
+// Include files
+
+#include <stdlib.h>
+#include <assert.h>
+#include "R2BufferPool.h"
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Heap helpers
+////////////////////////////////////////////////////////////////////////
+
+static void *
+AllocateAligned(size_t size)
+{
+  // Allocate size bytes starting on a R2_BUFFER_POOL_ALIGNMENT boundary
+  void *p = NULL;
+#ifdef _WIN32
+  p = _aligned_malloc(size, R2_BUFFER_POOL_ALIGNMENT);
+#else
+  if (posix_memalign(&p, R2_BUFFER_POOL_ALIGNMENT, size) != 0) p = NULL;
+#endif
+  assert(p);
+  return p;
+}
+
+
+
+static void
+FreeAligned(void *p)
+{
+  // Free memory from AllocateAligned
+#ifdef _WIN32
+  _aligned_free(p);
+#else
+  free(p);
+#endif
+}
+
+
+
+static size_t
+SizeClass(size_t size)
+{
+  // Round size up to one of four steps per power of two, so buffers whose
+  // size drifts a little from call to call (search regions) share a class
+  size_t step = R2_BUFFER_POOL_ALIGNMENT;
+  while (step * 8 <= size) step *= 2;
+  return ((size + step - 1) / step) * step;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Constructors/destructor
+////////////////////////////////////////////////////////////////////////
+
+R2BufferPool& R2BufferPool::
+ThreadPool(void)
+{
+  // One pool per thread, freed when the thread exits
+  static thread_local R2BufferPool pool;
+  return pool;
+}
+
+
+
+R2BufferPool::
+R2BufferPool(void)
+  : freeBuffers(),
+    nheapAllocations(0),
+    nreuses(0),
+    bytesInUse(0),
+    highWaterBytes(0),
+    bytesCached(0)
+{
+}
+
+
+
+R2BufferPool::
+~R2BufferPool(void)
+{
+  // Return cached buffers to the heap
+  Trim();
+}
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Buffer allocation
+////////////////////////////////////////////////////////////////////////
+
+void *R2BufferPool::
+Allocate(size_t size)
+{
+  // Nothing to allocate
+  if (size == 0) return NULL;
+  size = SizeClass(size);
+
+  // Reuse a released buffer of the same size if there is one
+  void *buffer = NULL;
+  std::map<size_t, std::vector<void *> >::iterator it = freeBuffers.find(size);
+  if ((it != freeBuffers.end()) && !it->second.empty()) {
+    buffer = it->second.back();
+    it->second.pop_back();
+    bytesCached -= size;
+    nreuses++;
+  }
+  else {
+    buffer = AllocateAligned(size);
+    nheapAllocations++;
+  }
+
+  // Update statistics
+  bytesInUse += size;
+  if (bytesInUse > highWaterBytes) highWaterBytes = bytesInUse;
+  return buffer;
+}
+
+
+
+void R2BufferPool::
+Release(void *buffer, size_t size)
+{
+  // Nothing to release
+  if (!buffer) return;
+  size = SizeClass(size);
+
+  // Buffers from another thread's pool were never counted here
+  bytesInUse = (size < bytesInUse) ? bytesInUse - size : 0;
+
+  // Keep buffer for the next request of this size, unless enough are kept
+  // already (per size, and never more in total than the high-water mark)
+  std::vector<void *>& buffers = freeBuffers[size];
+  if ((buffers.size() < R2_BUFFER_POOL_MAX_CACHED_BUFFERS) && (bytesCached + size <= highWaterBytes)) {
+    buffers.push_back(buffer);
+    bytesCached += size;
+  }
+  else {
+    FreeAligned(buffer);
+  }
+}
+
+
+
+void R2BufferPool::
+Trim(void)
+{
+  // Return all released buffers to the heap
+  std::map<size_t, std::vector<void *> >::iterator it;
+  for (it = freeBuffers.begin(); it != freeBuffers.end(); ++it) {
+    for (size_t i = 0; i < it->second.size(); i++) {
+      FreeAligned(it->second[i]);
+    }
+  }
+  freeBuffers.clear();
+  bytesCached = 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Statistics
+////////////////////////////////////////////////////////////////////////
+
+void R2BufferPool::
+PrintStats(FILE *fp) const
+{
+  // Print one line summary
+  fprintf(fp, "Buffer pool: %lu heap allocations, %lu reuses, %.1f MB in use, %.1f MB high water, %.1f MB cached\n",
+    (unsigned long) nheapAllocations, (unsigned long) nreuses,
+    bytesInUse / 1048576.0, highWaterBytes / 1048576.0, bytesCached / 1048576.0);
+}
@@ -0,0 +1,118 @@
+// Include file for pixel buffer pool class
+#ifndef R2_BUFFER_POOL_INCLUDED
+#define R2_BUFFER_POOL_INCLUDED
+
+
+
+// Include files
+
+#include <stddef.h>
+#include <stdio.h>
+#include <map>
+#include <vector>
+
+
+
+// Constant definitions
+
+// Every buffer starts on a cache line boundary
+#define R2_BUFFER_POOL_ALIGNMENT 64
+
+// Released buffers kept per size (further ones go back to the heap)
+#define R2_BUFFER_POOL_MAX_CACHED_BUFFERS 4
+
+
+
+// Class definition
+
+// Keeps released buffers keyed by size (rounded up to a size class) so the
+// next request of the same size reuses one instead of going to the heap. Each
+// thread has its own pool (ThreadPool()), so no locking is needed; a buffer
+// released on a different thread than it was allocated on simply joins the
+// releasing thread's pool.
+class R2BufferPool {
+ public:
+  // Pool of the calling thread
+  static R2BufferPool& ThreadPool(void);
+
+  // Constructor/destructor
+  R2BufferPool(void);
+  ~R2BufferPool(void);
+
+  // Buffer allocation (size in bytes, the same size must be given on release)
+  void *Allocate(size_t size);
+  void Release(void *buffer, size_t size);
+  void Trim(void);
+
+  // Statistics
+  size_t NHeapAllocations(void) const;
+  size_t NReuses(void) const;
+  size_t BytesInUse(void) const;
+  size_t HighWaterBytes(void) const;
+  size_t BytesCached(void) const;
+  void PrintStats(FILE *fp) const;
+
+ private:
+  // Pools are not copied
+  R2BufferPool(const R2BufferPool& pool);
+  R2BufferPool& operator=(const R2BufferPool& pool);
+
+ private:
+  std::map<size_t, std::vector<void *> > freeBuffers;
+  size_t nheapAllocations;
+  size_t nreuses;
+  size_t bytesInUse;
+  size_t highWaterBytes;
+  size_t bytesCached;
+};
+
+
+
+// Inline functions
+
+inline size_t R2BufferPool::
+NHeapAllocations(void) const
+{
+  // Return number of requests that had to go to the heap
+  return nheapAllocations;
+}
+
+
+
+inline size_t R2BufferPool::
+NReuses(void) const
+{
+  // Return number of requests served from released buffers
+  return nreuses;
+}
+
+
+
+inline size_t R2BufferPool::
+BytesInUse(void) const
+{
+  // Return bytes handed out and not yet released
+  return bytesInUse;
+}
+
+
+
+inline size_t R2BufferPool::
+HighWaterBytes(void) const
+{
+  // Return largest BytesInUse() seen so far
+  return highWaterBytes;
+}
+
+
+
+inline size_t R2BufferPool::
+BytesCached(void) const
+{
+  // Return bytes held in released buffers
+  return bytesCached;
+}
+
+
+
+#endif
@@ -0,0 +1,358 @@
+// Source file for 8-bit packed image class
+
+
+
+// Include files
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <cmath>
+#include <utility>
+#include <algorithm>
+#include "R2Pixel.h"
+#include "R2Image.h"
+#include "R2ImageView.h"
+#include "R2PlanarImage.h"
+#include "R2ByteImage.h"
+#include "R2BufferPool.h"
+
+// SSE2 is part of every x86-64 target, other targets use the scalar loops
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#  define R2_BYTE_IMAGE_SSE2
+#  include <emmintrin.h>
+#endif
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Helpers
+////////////////////////////////////////////////////////////////////////
+
+static int
+PaddedStride(int rowBytes)
+{
+  // Round row length up so every row starts on an aligned boundary
+  const int a = R2_BYTE_IMAGE_ROW_ALIGNMENT;
+  return ((rowBytes + a - 1) / a) * a;
+}
+
+
+
+static unsigned char
+Quantize(double value)
+{
+  // Map [0, 1] to [0, 255], clamping values outside
+  if (value <= 0) return 0;
+  if (value >= 1) return 255;
+  return (unsigned char) (255 * value + 0.5);
+}
+
+
+
+static unsigned int
+RowSSD(const unsigned char *a, const unsigned char *b, int n, int nchannels)
+{
+  // Sum of squared differences of n bytes (alpha bytes of RGBA rows are skipped)
+  unsigned int sum = 0;
+  int k = 0;
+
+#ifdef R2_BYTE_IMAGE_SSE2
+  // 16 bytes at a time: widen to 16 bits, subtract, and let pmaddwd square and
+  // pair-sum into 32-bit lanes (one row of a marker cannot overflow them)
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i mask = _mm_set1_epi32((nchannels == 4) ? 0x00FFFFFF : -1);
+  __m128i acc = _mm_setzero_si128();
+  for (; k + 16 <= n; k += 16) {
+    const __m128i va = _mm_and_si128(_mm_loadu_si128((const __m128i *) (a + k)), mask);
+    const __m128i vb = _mm_and_si128(_mm_loadu_si128((const __m128i *) (b + k)), mask);
+    const __m128i lo = _mm_sub_epi16(_mm_unpacklo_epi8(va, zero), _mm_unpacklo_epi8(vb, zero));
+    const __m128i hi = _mm_sub_epi16(_mm_unpackhi_epi8(va, zero), _mm_unpackhi_epi8(vb, zero));
+    acc = _mm_add_epi32(acc, _mm_madd_epi16(lo, lo));
+    acc = _mm_add_epi32(acc, _mm_madd_epi16(hi, hi));
+  }
+  if (k + 8 <= n) {
+    // 8 more bytes (markers at coarse pyramid levels are often narrower than 16)
+    const __m128i va = _mm_and_si128(_mm_loadl_epi64((const __m128i *) (a + k)), mask);
+    const __m128i vb = _mm_and_si128(_mm_loadl_epi64((const __m128i *) (b + k)), mask);
+    const __m128i lo = _mm_sub_epi16(_mm_unpacklo_epi8(va, zero), _mm_unpacklo_epi8(vb, zero));
+    acc = _mm_add_epi32(acc, _mm_madd_epi16(lo, lo));
+    k += 8;
+  }
+  acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+  acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+  sum = (unsigned int) _mm_cvtsi128_si32(acc);
+#endif
+
+  // Remaining bytes
+  for (; k < n; k++) {
+    if ((nchannels == 4) && ((k & 3) == 3)) continue;
+    const int d = (int) a[k] - (int) b[k];
+    sum += d * d;
+  }
+  return sum;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Constructors/destructor
+////////////////////////////////////////////////////////////////////////
+
+R2ByteImage::
+R2ByteImage(void)
+  : data(NULL),
+    nchannels(0),
+    width(0),
+    height(0),
+    stride(0)
+{
+}
+
+
+
+R2ByteImage::
+R2ByteImage(int width, int height, int nchannels)
+  : data(NULL),
+    nchannels(0),
+    width(0),
+    height(0),
+    stride(0)
+{
+  // Allocate zeroed samples
+  Resize(width, height, nchannels);
+}
+
+
+
+R2ByteImage::
+R2ByteImage(const R2ImageView& view, int nchannels)
+  : data(NULL),
+    nchannels(0),
+    width(0),
+    height(0),
+    stride(0)
+{
+  // Quantize pixels under the view
+  FromImage(view, nchannels);
+}
+
+
+
+R2ByteImage::
+R2ByteImage(const R2ByteImage& image)
+  : data(NULL),
+    nchannels(0),
+    width(0),
+    height(0),
+    stride(0)
+{
+  // Copy samples
+  *this = image;
+}
+
+
+
+R2ByteImage::
+R2ByteImage(R2ByteImage&& image) noexcept
+  : data(image.data),
+    nchannels(image.nchannels),
+    width(image.width),
+    height(image.height),
+    stride(image.stride)
+{
+  // Steal samples, leave image empty
+  image.data = NULL;
+  image.nchannels = image.width = image.height = image.stride = 0;
+}
+
+
+
+R2ByteImage::
+~R2ByteImage(void)
+{
+  // Free samples
+  R2BufferPool::ThreadPool().Release(data, (size_t) stride * height);
+}
+
+
+
+R2ByteImage& R2ByteImage::
+operator=(const R2ByteImage& image)
+{
+  // Check for self assignment
+  if (this == &image) return *this;
+
+  // Copy samples (padding included)
+  Resize(image.width, image.height, image.nchannels);
+  if (data) memcpy(data, image.data, (size_t) stride * height);
+
+  // Return image
+  return *this;
+}
+
+
+
+R2ByteImage& R2ByteImage::
+operator=(R2ByteImage&& image) noexcept
+{
+  // Take over samples, the old ones go away with image
+  swap(image);
+
+  // Return image
+  return *this;
+}
+
+
+
+void R2ByteImage::
+swap(R2ByteImage& image) noexcept
+{
+  // Exchange samples and shape without copying
+  std::swap(data, image.data);
+  std::swap(nchannels, image.nchannels);
+  std::swap(width, image.width);
+  std::swap(height, image.height);
+  std::swap(stride, image.stride);
+}
+
+
+
+void R2ByteImage::
+Resize(int w, int h, int n)
+{
+  // Only luma and RGBA are supported
+  assert((n == 1) || (n == 4));
+
+  // Reallocate only if the shape changes
+  const int newStride = PaddedStride(w * n);
+  if ((newStride * h != stride * height) || !data) {
+    R2BufferPool::ThreadPool().Release(data, (size_t) stride * height);
+    data = (unsigned char *) R2BufferPool::ThreadPool().Allocate((size_t) newStride * h);
+  }
+  width = w;
+  height = h;
+  nchannels = n;
+  stride = newStride;
+  if (data) memset(data, 0, (size_t) stride * height);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Conversion
+////////////////////////////////////////////////////////////////////////
+
+void R2ByteImage::
+FromImage(const R2ImageView& view, int n)
+{
+  // Quantize pixels under the view to luma (R2Pixel::Luminance()) or RGBA bytes
+  Resize(view.Width(), view.Height(), n);
+  for (int y = 0; y < height; y++) {
+    unsigned char *row = Row(y);
+    for (int x = 0; x < width; x++) {
+      const R2Pixel& pixel = view.Pixel(x, y);
+      if (nchannels == 1) {
+        row[x] = Quantize(pixel.Luminance());
+      }
+      else {
+        for (int c = 0; c < 4; c++) {
+          row[4*x + c] = Quantize(pixel[c]);
+        }
+      }
+    }
+  }
+}
+
+
+
+void R2ByteImage::
+FromLuminance(const R2PlanarImage& image)
+{
+  // Quantize the first plane of image (a luminance level of a pyramid) to luma
+  Resize(image.Width(), image.Height(), 1);
+  for (int y = 0; y < height; y++) {
+    const float *values = image.Row(0, y);
+    unsigned char *row = Row(y);
+    for (int x = 0; x < width; x++) {
+      row[x] = Quantize(values[x]);
+    }
+  }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////
+// SSD
+////////////////////////////////////////////////////////////////////////
+
+float R2ByteImage::
+calculateSSD(const int x0, const int y0, const R2ByteImage& marker) const
+{
+  // Sum of squared color differences between marker and the window centered at (x0, y0),
+  // accumulated in integers and scaled back so a full-range difference counts 1
+  assert(marker.NChannels() == nchannels);
+  const int xReach = marker.Width() / 2;
+  const int yReach = marker.Height() / 2;
+  const int xEnd = marker.Width() - xReach;
+  const int yEnd = marker.Height() - yReach;
+  const int colorChannels = (nchannels < 3) ? nchannels : 3;
+  const unsigned int outOfBounds = 255 * 255 * colorChannels;
+
+  // Fast path when the whole window is inside the image
+  const bool inside = (x0 - xReach >= 0) && (x0 + xEnd <= width) && (y0 - yReach >= 0) && (y0 + yEnd <= height);
+
+  double sum = 0;
+  for (int j = -yReach; j < yEnd; j++) {
+    const unsigned char *m = marker.Row(yReach + j);
+    if (inside) {
+      sum += RowSSD(Row(y0 + j) + (x0 - xReach) * nchannels, m, marker.Width() * nchannels, nchannels);
+    }
+    else {
+      unsigned int rowSum = 0;
+      for (int i = -xReach; i < xEnd; i++) {
+        if (inBounds(x0 + i, y0 + j)) {
+          rowSum += RowSSD(Row(y0 + j) + (x0 + i) * nchannels, m + (xReach + i) * nchannels, nchannels, nchannels);
+        } else {
+          // account for out of bounds pixels by adding max possible ssd
+          rowSum += outOfBounds;
+        }
+      }
+      sum += rowSum;
+    }
+  }
+  return (float) (sum / (255.0 * 255.0));
+}
+
+
+
+float R2ByteImage::
+calculateSSD(const int x0, const int y0, const R2ByteImage& marker, const int *rowOrder, const float bound) const
+{
+  // calculateSSD(x0, y0, marker) one marker row at a time in rowOrder, giving up
+  // once the sum (kept in integers, 255 * 255 per full-range difference) exceeds bound
+  assert((nchannels == 1) && (marker.NChannels() == 1));
+  const int xReach = marker.Width() / 2;
+  const int yReach = marker.Height() / 2;
+  const int xEnd = marker.Width() - xReach;
+  const double limit = (double) bound * (255.0 * 255.0);
+
+  // Marker columns over the image, the rest add the max of 255 * 255 per pixel
+  const int iMin = std::max(-xReach, -x0);
+  const int iMax = std::min(xEnd, width - x0);
+  const unsigned int outside = 255 * 255 * ((iMax > iMin) ? marker.Width() - (iMax - iMin) : marker.Width());
+
+  double sum = 0;
+  for (int k = 0; k < marker.Height(); k++) {
+    const int y = y0 + rowOrder[k] - yReach;
+    if ((y < 0) || (y >= height) || (iMax <= iMin)) {
+      sum += 255 * 255 * marker.Width();
+    }
+    else {
+      sum += RowSSD(Row(y) + x0 + iMin, marker.Row(y - y0 + yReach) + xReach + iMin, iMax - iMin, 1) + outside;
+    }
+    if (sum > limit) break;
+  }
+  return (float) (sum / (255.0 * 255.0));
+}
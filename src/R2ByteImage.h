@@ -0,0 +1,161 @@
+// Include file for 8-bit packed image class
+#ifndef R2_BYTE_IMAGE_INCLUDED
+#define R2_BYTE_IMAGE_INCLUDED
+
+
+
+// Constant definitions
+
+// Rows start on a cache line boundary (strides are multiples of this many bytes)
+#define R2_BYTE_IMAGE_ROW_ALIGNMENT 64
+
+
+
+// Class definition
+
+class R2Image;
+class R2ImageView;
+class R2Pixel;
+class R2PlanarImage;
+
+// 8-bit image with one (luma) or four (RGBA) interleaved channels per pixel.
+// Rows start at the bottom like R2Image and are Stride() bytes apart. Used for
+// template matching, where 8-bit precision is enough and integer SIMD applies.
+class R2ByteImage {
+ public:
+  // Constructors/destructor
+  R2ByteImage(void);
+  R2ByteImage(int width, int height, int nchannels = 1);
+  R2ByteImage(const R2ImageView& view, int nchannels = 1);
+  R2ByteImage(const R2ByteImage& image);
+  R2ByteImage(R2ByteImage&& image) noexcept;
+  ~R2ByteImage(void);
+
+  // Image properties
+  int Width(void) const;
+  int Height(void) const;
+  int NChannels(void) const;
+  int Stride(void) const;
+
+  // Sample access/update
+  unsigned char *Row(int y);
+  const unsigned char *Row(int y) const;
+  unsigned char& Value(int channel, int x, int y);
+  unsigned char Value(int channel, int x, int y) const;
+
+  // Conversion
+  R2ByteImage& operator=(const R2ByteImage& image);
+  R2ByteImage& operator=(R2ByteImage&& image) noexcept;
+  void swap(R2ByteImage& image) noexcept;
+  void FromImage(const R2ImageView& view, int nchannels = 1);
+  void FromLuminance(const R2PlanarImage& image);
+
+  // ssd (same window and scale as R2PlanarImage::calculateSSD, color channels only)
+  float calculateSSD(const int x0, const int y0, const R2ByteImage& marker) const;
+
+  // Bounded ssd of luma images, like R2PlanarImage's: marker rows are summed in
+  // rowOrder (from R2PlanarImage::calculateSSDRowOrder of the same marker) and the
+  // partial sum is returned as soon as it exceeds bound
+  float calculateSSD(const int x0, const int y0, const R2ByteImage& marker, const int *rowOrder, const float bound) const;
+
+  // helpers
+  bool inBounds(const int x, const int y) const;
+
+ private:
+  // Utility functions
+  void Resize(int width, int height, int nchannels);
+
+ private:
+  unsigned char *data;
+  int nchannels;
+  int width;
+  int height;
+  int stride;
+};
+
+
+
+// Inline functions
+
+inline int R2ByteImage::
+Width(void) const
+{
+  // Return width
+  return width;
+}
+
+
+
+inline int R2ByteImage::
+Height(void) const
+{
+  // Return height
+  return height;
+}
+
+
+
+inline int R2ByteImage::
+NChannels(void) const
+{
+  // Return number of interleaved channels
+  return nchannels;
+}
+
+
+
+inline int R2ByteImage::
+Stride(void) const
+{
+  // Return number of bytes between the starts of consecutive rows
+  return stride;
+}
+
+
+
+inline unsigned char *R2ByteImage::
+Row(int y)
+{
+  // Return pointer to row y
+  return &data[y * stride];
+}
+
+
+
+inline const unsigned char *R2ByteImage::
+Row(int y) const
+{
+  // Return pointer to row y
+  return &data[y * stride];
+}
+
+
+
+inline unsigned char& R2ByteImage::
+Value(int channel, int x, int y)
+{
+  // Return value of one channel at (x,y)
+  return data[y * stride + x * nchannels + channel];
+}
+
+
+
+inline unsigned char R2ByteImage::
+Value(int channel, int x, int y) const
+{
+  // Return value of one channel at (x,y)
+  return data[y * stride + x * nchannels + channel];
+}
+
+
+
+inline bool R2ByteImage::
+inBounds(const int x, const int y) const
+{
+  // Return whether (x,y) is inside the image
+  return (x >= 0) && (x < width) && (y >= 0) && (y < height);
+}
+
+
+
+#endif
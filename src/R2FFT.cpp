@@ -0,0 +1,92 @@
+// Source file for fast Fourier transforms
+
+
+
+// Include files
+
+#include <stdio.h>
+#include <assert.h>
+#include <cmath>
+#include <vector>
+#include <utility>
+#include "R2FFT.h"
+
+
+
+// Constant definitions
+
+// Not M_PI, which MSVC only defines with _USE_MATH_DEFINES
+static const double R2_FFT_PI = 3.14159265358979323846;
+
+
+
+////////////////////////////////////////////////////////////////////////
+// 1D transform
+////////////////////////////////////////////////////////////////////////
+
+int
+R2FFTSize(int n)
+{
+  // Smallest power of two >= n
+  int size = 1;
+  while (size < n) size *= 2;
+  return size;
+}
+
+
+
+void
+R2FFT(std::complex<double> *data, int n, bool inverse)
+{
+  // Iterative Cooley-Tukey: bit-reversal permutation, then butterflies
+  assert((n & (n - 1)) == 0);
+  for (int i = 1, j = 0; i < n; i++) {
+    int bit = n >> 1;
+    for (; j & bit; bit >>= 1) j ^= bit;
+    j ^= bit;
+    if (i < j) std::swap(data[i], data[j]);
+  }
+
+  for (int length = 2; length <= n; length *= 2) {
+    // Twiddle factors by recurrence, one rotation per butterfly column
+    const double angle = ((inverse) ? 2 : -2) * R2_FFT_PI / length;
+    const std::complex<double> rotation(cos(angle), sin(angle));
+    for (int start = 0; start < n; start += length) {
+      std::complex<double> w(1, 0);
+      for (int k = 0; k < length / 2; k++) {
+        const std::complex<double> a = data[start + k];
+        const std::complex<double> b = data[start + k + length / 2] * w;
+        data[start + k] = a + b;
+        data[start + k + length / 2] = a - b;
+        w *= rotation;
+      }
+    }
+  }
+
+  if (inverse) {
+    const double scale = 1.0 / n;
+    for (int i = 0; i < n; i++) data[i] *= scale;
+  }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////
+// 2D transform
+////////////////////////////////////////////////////////////////////////
+
+void
+R2FFT2D(std::complex<double> *data, int width, int height, bool inverse)
+{
+  // Rows in place, then columns through a contiguous scratch line
+  for (int j = 0; j < height; j++) {
+    R2FFT(&data[(size_t) j * width], width, inverse);
+  }
+
+  std::vector<std::complex<double> > column(height);
+  for (int i = 0; i < width; i++) {
+    for (int j = 0; j < height; j++) column[j] = data[(size_t) j * width + i];
+    R2FFT(column.data(), height, inverse);
+    for (int j = 0; j < height; j++) data[(size_t) j * width + i] = column[j];
+  }
+}
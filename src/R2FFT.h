@@ -0,0 +1,26 @@
+// Include file for fast Fourier transforms
+#ifndef R2_FFT_INCLUDED
+#define R2_FFT_INCLUDED
+
+
+
+// Include files
+
+#include <complex>
+
+
+
+// Function declarations
+
+// Smallest power of two >= n (transform sizes must be powers of two)
+int R2FFTSize(int n);
+
+// In-place radix-2 transform of n values (the inverse includes the 1 / n)
+void R2FFT(std::complex<double> *data, int n, bool inverse);
+
+// In-place 2D transform of a row-major width x height array (rows then columns)
+void R2FFT2D(std::complex<double> *data, int width, int height, bool inverse);
+
+
+
+#endif
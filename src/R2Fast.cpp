@@ -0,0 +1,330 @@
+// Source file for FAST segment test corner detection
+
+
+
+// Include files
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "R2Fast.h"
+
+// Same instruction sets as R2Blur: SSE2 is part of every x86-64 target, AVX2 code
+// is compiled with per-function target attributes and only called when the CPU
+// reports it.
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#  define R2_FAST_HAVE_SSE2
+#  include <emmintrin.h>
+#endif
+#if defined(R2_FAST_HAVE_SSE2) && defined(__GNUC__)
+#  define R2_FAST_HAVE_AVX2
+#  include <immintrin.h>
+#endif
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Row kernels
+////////////////////////////////////////////////////////////////////////
+
+// Each instruction set scores the centers [begin, end) of a row. offsets are
+// those of the circle pixels from a center, clockwise from straight up, so the
+// compass pixels are every fourth one. Returns the number of corners.
+typedef int (*ScoreRowFunction)(const float *row, const int *offsets, int begin, int end, int arc, float threshold, float *scores);
+
+
+
+static inline bool
+HasArc(unsigned int mask, int arc)
+{
+  // Whether arc contiguous bits of a circle mask are set, wrapping around
+  const unsigned int wrapped = mask | (mask << R2_FAST_CIRCLE);
+  unsigned int run = wrapped;
+  for (int k = 1; (k < arc) && run; k++) run &= wrapped >> k;
+  return run != 0;
+}
+
+
+
+static int
+FinishLanes(int nlanes, const int *bright, const int *dark, const float *brightSum, const float *darkSum, int arc, float *scores)
+{
+  // Score the lanes of a vector of centers from their circle masks and sums
+  int ncorners = 0;
+  for (int l = 0; l < nlanes; l++) {
+    scores[l] = 0;
+    if (!HasArc(bright[l], arc) && !HasArc(dark[l], arc)) continue;
+    scores[l] = (brightSum[l] > darkSum[l]) ? brightSum[l] : darkSum[l];
+    ncorners++;
+  }
+  return ncorners;
+}
+
+
+
+static int
+ScoreRowScalar(const float *row, const int *offsets, int begin, int end, int arc, float threshold, float *scores)
+{
+  // One center at a time
+  int ncorners = 0;
+  for (int i = begin; i < end; i++) {
+    const float *p = &row[i];
+    const float hi = p[0] + threshold;
+    const float lo = p[0] - threshold;
+    scores[i] = 0;
+
+    // Any arc covers at least arc / 4 of the compass pixels
+    int nbright = 0, ndark = 0;
+    for (int k = 0; k < R2_FAST_CIRCLE; k += 4) {
+      nbright += (p[offsets[k]] > hi);
+      ndark += (p[offsets[k]] < lo);
+    }
+    if ((nbright < arc / 4) && (ndark < arc / 4)) continue;
+
+    // Whole circle
+    int bright = 0, dark = 0;
+    float brightSum = 0, darkSum = 0;
+    for (int k = 0; k < R2_FAST_CIRCLE; k++) {
+      const float v = p[offsets[k]];
+      if (v > hi) { bright |= 1 << k; brightSum += v - hi; }
+      else if (v < lo) { dark |= 1 << k; darkSum += lo - v; }
+    }
+    ncorners += FinishLanes(1, &bright, &dark, &brightSum, &darkSum, arc, &scores[i]);
+  }
+  return ncorners;
+}
+
+
+
+#ifdef R2_FAST_HAVE_SSE2
+
+static int
+ScoreRowSSE2(const float *row, const int *offsets, int begin, int end, int arc, float threshold, float *scores)
+{
+  // Same as ScoreRowScalar for four neighboring centers at a time: the circle is
+  // compared a vector at a time into per lane masks and sums (adding zero for the
+  // pixels a lane does not count keeps the sums bit identical)
+  const __m128 t = _mm_set1_ps(threshold);
+  const __m128i needed = _mm_set1_epi32(arc / 4 - 1);
+  int ncorners = 0;
+  int i = begin;
+  for (; i + 4 <= end; i += 4) {
+    const float *p = &row[i];
+    const __m128 center = _mm_loadu_ps(p);
+    const __m128 hi = _mm_add_ps(center, t);
+    const __m128 lo = _mm_sub_ps(center, t);
+
+    // Compass pixels reject most centers, often all four
+    __m128i nbright = _mm_setzero_si128();
+    __m128i ndark = _mm_setzero_si128();
+    for (int k = 0; k < R2_FAST_CIRCLE; k += 4) {
+      const __m128 v = _mm_loadu_ps(p + offsets[k]);
+      nbright = _mm_sub_epi32(nbright, _mm_castps_si128(_mm_cmpgt_ps(v, hi)));
+      ndark = _mm_sub_epi32(ndark, _mm_castps_si128(_mm_cmplt_ps(v, lo)));
+    }
+    const __m128i pass = _mm_or_si128(_mm_cmpgt_epi32(nbright, needed), _mm_cmpgt_epi32(ndark, needed));
+    if (!_mm_movemask_ps(_mm_castsi128_ps(pass))) {
+      _mm_storeu_ps(&scores[i], _mm_setzero_ps());
+      continue;
+    }
+
+    // Whole circle
+    __m128i bright = _mm_setzero_si128();
+    __m128i dark = _mm_setzero_si128();
+    __m128 brightSum = _mm_setzero_ps();
+    __m128 darkSum = _mm_setzero_ps();
+    for (int k = 0; k < R2_FAST_CIRCLE; k++) {
+      const __m128 v = _mm_loadu_ps(p + offsets[k]);
+      const __m128 b = _mm_cmpgt_ps(v, hi);
+      const __m128 d = _mm_cmplt_ps(v, lo);
+      const __m128i bit = _mm_set1_epi32(1 << k);
+      bright = _mm_or_si128(bright, _mm_and_si128(_mm_castps_si128(b), bit));
+      dark = _mm_or_si128(dark, _mm_and_si128(_mm_castps_si128(d), bit));
+      brightSum = _mm_add_ps(brightSum, _mm_and_ps(b, _mm_sub_ps(v, hi)));
+      darkSum = _mm_add_ps(darkSum, _mm_and_ps(d, _mm_sub_ps(lo, v)));
+    }
+    int brightLanes[4], darkLanes[4];
+    float brightSums[4], darkSums[4];
+    _mm_storeu_si128((__m128i *) brightLanes, bright);
+    _mm_storeu_si128((__m128i *) darkLanes, dark);
+    _mm_storeu_ps(brightSums, brightSum);
+    _mm_storeu_ps(darkSums, darkSum);
+    ncorners += FinishLanes(4, brightLanes, darkLanes, brightSums, darkSums, arc, &scores[i]);
+  }
+  return ncorners + ScoreRowScalar(row, offsets, i, end, arc, threshold, scores);
+}
+
+#endif
+
+
+
+#ifdef R2_FAST_HAVE_AVX2
+
+__attribute__((target("avx2")))
+static int
+ScoreRowAVX2(const float *row, const int *offsets, int begin, int end, int arc, float threshold, float *scores)
+{
+  // Same as ScoreRowSSE2, eight centers at a time
+  const __m256 t = _mm256_set1_ps(threshold);
+  const __m256i needed = _mm256_set1_epi32(arc / 4 - 1);
+  int ncorners = 0;
+  int i = begin;
+  for (; i + 8 <= end; i += 8) {
+    const float *p = &row[i];
+    const __m256 center = _mm256_loadu_ps(p);
+    const __m256 hi = _mm256_add_ps(center, t);
+    const __m256 lo = _mm256_sub_ps(center, t);
+
+    // Compass pixels reject most centers, often all eight
+    __m256i nbright = _mm256_setzero_si256();
+    __m256i ndark = _mm256_setzero_si256();
+    for (int k = 0; k < R2_FAST_CIRCLE; k += 4) {
+      const __m256 v = _mm256_loadu_ps(p + offsets[k]);
+      nbright = _mm256_sub_epi32(nbright, _mm256_castps_si256(_mm256_cmp_ps(v, hi, _CMP_GT_OQ)));
+      ndark = _mm256_sub_epi32(ndark, _mm256_castps_si256(_mm256_cmp_ps(v, lo, _CMP_LT_OQ)));
+    }
+    const __m256i pass = _mm256_or_si256(_mm256_cmpgt_epi32(nbright, needed), _mm256_cmpgt_epi32(ndark, needed));
+    if (!_mm256_movemask_ps(_mm256_castsi256_ps(pass))) {
+      _mm256_storeu_ps(&scores[i], _mm256_setzero_ps());
+      continue;
+    }
+
+    // Whole circle
+    __m256i bright = _mm256_setzero_si256();
+    __m256i dark = _mm256_setzero_si256();
+    __m256 brightSum = _mm256_setzero_ps();
+    __m256 darkSum = _mm256_setzero_ps();
+    for (int k = 0; k < R2_FAST_CIRCLE; k++) {
+      const __m256 v = _mm256_loadu_ps(p + offsets[k]);
+      const __m256 b = _mm256_cmp_ps(v, hi, _CMP_GT_OQ);
+      const __m256 d = _mm256_cmp_ps(v, lo, _CMP_LT_OQ);
+      const __m256i bit = _mm256_set1_epi32(1 << k);
+      bright = _mm256_or_si256(bright, _mm256_and_si256(_mm256_castps_si256(b), bit));
+      dark = _mm256_or_si256(dark, _mm256_and_si256(_mm256_castps_si256(d), bit));
+      brightSum = _mm256_add_ps(brightSum, _mm256_and_ps(b, _mm256_sub_ps(v, hi)));
+      darkSum = _mm256_add_ps(darkSum, _mm256_and_ps(d, _mm256_sub_ps(lo, v)));
+    }
+    int brightLanes[8], darkLanes[8];
+    float brightSums[8], darkSums[8];
+    _mm256_storeu_si256((__m256i *) brightLanes, bright);
+    _mm256_storeu_si256((__m256i *) darkLanes, dark);
+    _mm256_storeu_ps(brightSums, brightSum);
+    _mm256_storeu_ps(darkSums, darkSum);
+    ncorners += FinishLanes(8, brightLanes, darkLanes, brightSums, darkSums, arc, &scores[i]);
+  }
+  return ncorners + ScoreRowScalar(row, offsets, i, end, arc, threshold, scores);
+}
+
+#endif
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Dispatch
+////////////////////////////////////////////////////////////////////////
+
+static R2FastInstructionSet
+BestInstructionSet(void)
+{
+  // Best instruction set this build and CPU support
+#ifdef R2_FAST_HAVE_AVX2
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) return R2_FAST_AVX2;
+#endif
+#ifdef R2_FAST_HAVE_SSE2
+  return R2_FAST_SSE2;
+#else
+  return R2_FAST_SCALAR;
+#endif
+}
+
+
+
+static R2FastInstructionSet&
+CurrentInstructionSet(void)
+{
+  // Selected instruction set, initialized on first use
+  static R2FastInstructionSet instructionSet = BestInstructionSet();
+  return instructionSet;
+}
+
+
+
+R2FastInstructionSet
+R2FastGetInstructionSet(void)
+{
+  // Return selected instruction set
+  return CurrentInstructionSet();
+}
+
+
+
+void
+R2FastSetInstructionSet(R2FastInstructionSet instructionSet)
+{
+  // Select instruction set, never above what the CPU supports
+  const R2FastInstructionSet best = BestInstructionSet();
+  CurrentInstructionSet() = (instructionSet < best) ? instructionSet : best;
+}
+
+
+
+const char *
+R2FastInstructionSetName(R2FastInstructionSet instructionSet)
+{
+  // Return printable name
+  switch (instructionSet) {
+  case R2_FAST_SCALAR: return "scalar";
+  case R2_FAST_SSE2: return "SSE2";
+  case R2_FAST_AVX2: return "AVX2";
+  default: return "unknown";
+  }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Segment test
+////////////////////////////////////////////////////////////////////////
+
+int
+R2FastScorePlane(const float *plane, int width, int height, int stride, int arc, float threshold, float *scores)
+{
+  // Check arguments
+  if ((arc < 4) || (arc > R2_FAST_CIRCLE)) {
+    fprintf(stderr, "Invalid FAST arc: %d\n", arc);
+    return 0;
+  }
+
+  // Circle offsets, clockwise from straight up (rows go up the plane)
+  static const int circle[R2_FAST_CIRCLE][2] = {
+    { 0, 3 }, { 1, 3 }, { 2, 2 }, { 3, 1 }, { 3, 0 }, { 3, -1 }, { 2, -2 }, { 1, -3 },
+    { 0, -3 }, { -1, -3 }, { -2, -2 }, { -3, -1 }, { -3, 0 }, { -3, 1 }, { -2, 2 }, { -1, 3 }
+  };
+  int offsets[R2_FAST_CIRCLE];
+  for (int k = 0; k < R2_FAST_CIRCLE; k++) offsets[k] = circle[k][1] * stride + circle[k][0];
+
+  // Row kernel of the selected instruction set
+  ScoreRowFunction scoreRow = ScoreRowScalar;
+  switch (R2FastGetInstructionSet()) {
+#ifdef R2_FAST_HAVE_AVX2
+  case R2_FAST_AVX2: scoreRow = ScoreRowAVX2; break;
+#endif
+#ifdef R2_FAST_HAVE_SSE2
+  case R2_FAST_SSE2: scoreRow = ScoreRowSSE2; break;
+#endif
+  default: break;
+  }
+
+  // Score rows, pixels without a whole circle are no corners
+  int ncorners = 0;
+  for (int y = 0; y < height; y++) {
+    float *out = &scores[y * stride];
+    if ((y < R2_FAST_RADIUS) || (y >= height - R2_FAST_RADIUS) || (width <= 2 * R2_FAST_RADIUS)) {
+      for (int x = 0; x < width; x++) out[x] = 0;
+      continue;
+    }
+    for (int x = 0; x < R2_FAST_RADIUS; x++) out[x] = out[width - 1 - x] = 0;
+    ncorners += scoreRow(&plane[y * stride], offsets, R2_FAST_RADIUS, width - R2_FAST_RADIUS, arc, threshold, out);
+  }
+  return ncorners;
+}
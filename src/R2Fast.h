@@ -0,0 +1,46 @@
+// Include file for FAST segment test corner detection on float planes
+#ifndef R2_FAST_INCLUDED
+#define R2_FAST_INCLUDED
+
+
+
+// Constant definitions
+
+// The segment test looks at the 16 pixel Bresenham circle of radius 3
+#define R2_FAST_RADIUS 3
+#define R2_FAST_CIRCLE 16
+
+// FAST-9: 9 contiguous circle pixels brighter or darker than the center by more
+// than the threshold (0.05 is about 13 of 255 levels). Planes are best blurred
+// by R2_FAST_DEFAULT_SIGMA first, single pixel noise makes corners flicker.
+#define R2_FAST_DEFAULT_ARC 9
+#define R2_FAST_DEFAULT_THRESHOLD 0.05
+#define R2_FAST_DEFAULT_SIGMA 1.5
+
+typedef enum {
+  R2_FAST_SCALAR,
+  R2_FAST_SSE2,
+  R2_FAST_AVX2,
+  R2_FAST_NUM_INSTRUCTION_SETS
+} R2FastInstructionSet;
+
+
+
+// Function declarations
+
+// Instruction set R2FastScorePlane runs with (the best one the CPU supports unless
+// set lower, requests above what the CPU supports fall back to the best one).
+// Every instruction set gives the same scores to the bit.
+R2FastInstructionSet R2FastGetInstructionSet(void);
+void R2FastSetInstructionSet(R2FastInstructionSet instructionSet);
+const char *R2FastInstructionSetName(R2FastInstructionSet instructionSet);
+
+// Segment test every pixel of a row-major plane (arc from 4 to 16). scores, with
+// the same stride, gets 0 for pixels that are not corners (and those within
+// R2_FAST_RADIUS of the border), else the larger of the summed amounts the bright
+// and the dark circle pixels exceed the threshold by. Returns the number of corners.
+int R2FastScorePlane(const float *plane, int width, int height, int stride, int arc, float threshold, float *scores);
+
+
+
+#endif
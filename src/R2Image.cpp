@@ -7,10 +7,26 @@
 #include "R2/R2.h"
 #include "R2Pixel.h"
 #include "R2Image.h"
+#include "R2ImageView.h"
+#include "R2BufferPool.h"
+#include "R2PlanarImage.h"
+#include "R2ByteImage.h"
+#include "R2ScaleSpace.h"
+#include "R2Pyramid.h"
+#include "R2FFT.h"
+#include "R2WorkerPool.h"
+#include "R2SummedAreaTable.h"
+#include "R2Fast.h"
+#include "R2Brief.h"
 #include "svd.h"
 #include <cmath>
+#include <cfloat>
 #include <vector>
-#include <pthread.h>
+#include <list>
+#include <atomic>
+#include <algorithm>
+#include <utility>
+#include <new>
 // #include <stdlib.h>     /* srand, rand */
 // #include <time.h>       /* time */
 
@@ -21,12 +37,87 @@
 bool R2Image:: inBounds(const Point p) const { return inBounds(p.x, p.y); }
 bool R2Image:: inBounds(const int x, const int y) const { return (x >= 0) && (x < width) && (y >= 0) && (y < height); }
 bool MULTI_THREAD = true;
+bool SCALE_SPACE_OCTAVES = false;
+
+// Markers are matched by zero mean NCC instead of ssd (see setMarkerNCC)
+bool MARKER_NCC = false;
+
+// Features are selected by adaptive non-maximal suppression (see setFeatureANMS)
+bool FEATURE_ANMS = false;
+
+// Features are FAST corners instead of Harris ones (see setFeatureFAST)
+bool FEATURE_FAST = false;
+
+// Features are matched by rotated BRIEF descriptors instead of ssd (see setFeatureBRIEF)
+bool FEATURE_BRIEF = false;
+
+// Feature matches are also searched for exhaustively (see setFeatureMatchVerify)
+bool FEATURE_MATCH_VERIFY = false;
+
+// Candidate positions the bounded ssd searches looked at, and how many of them
+// they gave up on part way (see printSSDStats)
+long SSD_CANDIDATES = 0;
+long SSD_PRUNED = 0;
+
+// Tracked markers Lucas-Kanade placed, and those that fell back to the search
+long MARKERS_TRACKED = 0;
+long MARKERS_SEARCHED = 0;
+
+// Feature matches verified against the exhaustive search, and those that differed
+long FEATURE_MATCHES_VERIFIED = 0;
+long FEATURE_MATCHES_DIFFERENT = 0;
 
 void R2Image::
 setMultiThread(bool mode) {
   MULTI_THREAD = mode;
 }
 
+void R2Image::
+setScaleSpaceOctaves(bool mode) {
+  SCALE_SPACE_OCTAVES = mode;
+}
+
+void R2Image::
+setFeatureANMS(bool mode) {
+  // Features then are the most isolated strong ones rather than just the strongest
+  FEATURE_ANMS = mode;
+}
+
+void R2Image::
+setFeatureFAST(bool mode) {
+  // Scale invariant detection stays with Harris, FAST corners have no scale
+  FEATURE_FAST = mode;
+}
+
+void R2Image::
+setFeatureBRIEF(bool mode) {
+  // Match ssds then are Hamming distances between descriptors
+  FEATURE_BRIEF = mode;
+}
+
+void R2Image::
+setFeatureMatchVerify(bool mode) {
+  // Matches then are those of the exhaustive search, coarse to fine ones are only counted
+  FEATURE_MATCH_VERIFY = mode;
+}
+
+void R2Image::
+setMarkerNCC(bool mode) {
+  // Marker ssds then are those of the standardized windows, 2 * pixels * (1 - zncc)
+  MARKER_NCC = mode;
+}
+
+void R2Image::
+printSSDStats(FILE *fp) const {
+  // One line summary of early termination in the bounded ssd searches
+  fprintf(fp, "SSD: %ld candidate positions, %ld pruned early (%.1f%%)\n",
+    SSD_CANDIDATES, SSD_PRUNED, (SSD_CANDIDATES > 0) ? 100.0 * SSD_PRUNED / SSD_CANDIDATES : 0.0);
+  fprintf(fp, "Markers: %ld tracked by Lucas-Kanade, %ld searched again\n", MARKERS_TRACKED, MARKERS_SEARCHED);
+  if (FEATURE_MATCHES_VERIFIED > 0) {
+    fprintf(fp, "Feature matches: %ld verified, %ld coarse to fine differ from the exhaustive search\n", FEATURE_MATCHES_VERIFIED, FEATURE_MATCHES_DIFFERENT);
+  }
+}
+
 ///////////////////////
 // Freeze Frame
 //////////////////////
@@ -47,7 +138,9 @@ Point calculateExtensionVector(Point& base, Point& a, Point& b) {
 
 void R2Image::
 placeImageInFrame(std::vector<Point>& markerLocations, R2Image& otherImage) {
-  otherImage.Blur(1.3, true);
+  // Work on planar float copy of the inner image (blur and warp both read it plane by plane)
+  R2PlanarImage planarImage(otherImage);
+  planarImage.Blur(1.3, true);
 
   // dependent on order of marker images... potentially fix later (these cant be references will fuck shit up)
   Point markerBottomLeft  = markerLocations[0];
@@ -104,15 +197,22 @@ placeImageInFrame(std::vector<Point>& markerLocations, R2Image& otherImage) {
 
   // Warp image into frame
   Frame shiftedFrame = Frame(shiftedBL, shiftedBR, shiftedTL, shiftedTR);
-  warpImageIntoFrame(H, otherImage, shiftedFrame);
+  warpImageIntoFrame(H, planarImage, shiftedFrame);
 }
 
 double R2Image:: 
 calculateOpacity(const double x, const double y, const double borderSize, R2Image& image) const { 
-  if (!image.inBounds(x, y)) return 0;
+  return calculateOpacity(x, y, borderSize, image.width, image.height);
+}
 
-  double xEdgeDist = fmin(x, image.width - x);
-  double yEdgeDist = fmin (y, image.height - y);
+double R2Image:: 
+calculateOpacity(const double x, const double y, const double borderSize, const int imageWidth, const int imageHeight) const { 
+  const int xi = x;
+  const int yi = y;
+  if (!((xi >= 0) && (xi < imageWidth) && (yi >= 0) && (yi < imageHeight))) return 0;
+
+  double xEdgeDist = fmin(x, imageWidth - x);
+  double yEdgeDist = fmin (y, imageHeight - y);
 
   double minEdgeDist = fmin(xEdgeDist, yEdgeDist); // this is the smallest distance to an edge 0.....width / height 
 
@@ -129,9 +229,16 @@ calculateOpacity(const double x, const double y, const double borderSize, R2Imag
 
 int R2Image:: 
 findSide(const double x, const double y, R2Image& image) const { 
-  if (!image.inBounds(x, y)) return -1;
-  double xr = image.width - x;
-  double yt = image.height - y;
+  return findSide(x, y, image.width, image.height);
+}
+
+int R2Image:: 
+findSide(const double x, const double y, const int imageWidth, const int imageHeight) const { 
+  const int xi = x;
+  const int yi = y;
+  if (!((xi >= 0) && (xi < imageWidth) && (yi >= 0) && (yi < imageHeight))) return -1;
+  double xr = imageWidth - x;
+  double yt = imageHeight - y;
 
   double smallerX = fmin(x, xr);
   double smallerY = fmin (y, yt);
@@ -183,17 +290,37 @@ findSampleColor(const double x, const double y, const double opacity, const doub
 
 void R2Image::
 warpImageIntoFrame(const std::vector<double>& homographyMatrix, R2Image& otherImage, Frame& frame) {
+  const R2PlanarImage planarImage(otherImage);
+  warpImageIntoFrame(homographyMatrix, planarImage, frame);
+}
+
+void R2Image::
+warpImageIntoFrame(const std::vector<double>& homographyMatrix, const R2PlanarImage& otherImage, Frame& frame) {
   int xLower = fmin(frame.topLeft.x, frame.bottomLeft.x);
   int xUpper = fmax(frame.topRight.x, frame.bottomRight.x) + 1;
   int yLower = fmin(frame.bottomLeft.y, frame.bottomRight.y);
   int yUpper = fmax(frame.topLeft.y, frame.topRight.y) + 1;
 
+  const int otherWidth = otherImage.Width();
+  const int otherHeight = otherImage.Height();
+  const int otherChannels = otherImage.NChannels();
+
   const double borderWidth = 45;
   //R2Pixel newspaperColor(240.0 / 255.0, 230.0 / 255.0, 223.0 / 255.0, 1);
   //drawSquare(xLower, yLower, xUpper, yUpper, 1,0,0);
 
-  for (int i = xLower; i < xUpper; i++) {
-    for (int j =  yLower;  j <= yUpper; j++) {
+  // Visit the bounding box in memory order (y outer for row-major, x outer for column-major)
+  const bool rowMajor = (layout == R2_IMAGE_ROW_MAJOR_LAYOUT);
+  const int outerLower = rowMajor ? yLower : xLower;
+  const int outerUpper = rowMajor ? yUpper + 1 : xUpper;
+  const int innerLower = rowMajor ? xLower : yLower;
+  const int innerUpper = rowMajor ? xUpper : yUpper + 1;
+
+  for (int outer = outerLower; outer < outerUpper; outer++) {
+    for (int inner = innerLower; inner < innerUpper; inner++) {
+      const int i = rowMajor ? inner : outer;
+      const int j = rowMajor ? outer : inner;
+
       // SOMEONE FIGURE OUT DYNAMIC PIXEL SELECTION
       const Point p = transformPoint(i, j, homographyMatrix);
       const int x0 = p.x;
@@ -205,43 +332,34 @@ warpImageIntoFrame(const std::vector<double>& homographyMatrix, R2Image& otherIm
       // make sure are in the image
       if (otherImage.inBounds(x0, y0)) {
         R2Pixel newspaperColor;
-        double opacity = calculateOpacity(p.x, p.y, borderWidth, otherImage);
+        double opacity = calculateOpacity(p.x, p.y, borderWidth, otherWidth, otherHeight);
 
         // If on border of video so should interpolate with newspaper
         if (opacity < 1) {
-          int side = findSide(p.x, p.y, otherImage);
+          int side = findSide(p.x, p.y, otherWidth, otherHeight);
           newspaperColor = findSampleColor(i, j, opacity, borderWidth, side);
-          // double midX = xUpper - xLower / 2.0;
-          // double midY = yUpper - yLower / 2.0;
-          // if (side == LEFT_SIDE) {
-          //     newspaperColor = Pixel(midX, midY);
-          // } else if (side == RIGHT_SIDE) { 
-          //     newspaperColor = Pixel(midX, midY);
-          // } else if (side == TOP_SIDE) { 
-          //     newspaperColor = Pixel(midX, midY);
-          // } else {
-          //     newspaperColor = Pixel(midX, midY);
-          // }
         } else {
           // this value wont be used as opacity is 1
           newspaperColor = R2Pixel(0,1,0,1);
         }
 
-        if (otherImage.inBounds(x0, y0) && otherImage.inBounds(x1, y1)) {
+        R2Pixel sample;
+        if (otherImage.inBounds(x1, y1)) {
+          // Bilinear interpolation, one plane at a time
           const double alphaX = p.x - x0;
           const double alphaY = p.y - y0;
-          R2Pixel upperHalf = (1 - alphaX) * otherImage.Pixel(x0, y0) + alphaX * otherImage.Pixel(x1, y0);
-          R2Pixel lowerHalf = (1 - alphaX) * otherImage.Pixel(x0, y1) + alphaX * otherImage.Pixel(x1, y1);
-
-          Pixel(i, j) = (1 - alphaY) * upperHalf + alphaY * lowerHalf;        
-          Pixel(i, j) = opacity * Pixel(i, j) + (1 - opacity) * newspaperColor;
-        } else if (otherImage.inBounds(x0, y0)) {
-          Pixel(i, j) = otherImage.Pixel(x0, y0);
-          Pixel(i, j) = opacity * Pixel(i, j) + (1 - opacity) * newspaperColor;
-        } else if (otherImage.inBounds(x1,y1)) {
-          Pixel(i, j) = otherImage.Pixel(x1, y1);
-          Pixel(i, j) = opacity * Pixel(i, j) + (1 - opacity) * newspaperColor;
+          for (int c = 0; c < otherChannels; c++) {
+            const float *row0 = otherImage.Row(c, y0);
+            const float *row1 = otherImage.Row(c, y1);
+            const double upperHalf = (1 - alphaX) * row0[x0] + alphaX * row0[x1];
+            const double lowerHalf = (1 - alphaX) * row1[x0] + alphaX * row1[x1];
+            sample[c] = (1 - alphaY) * upperHalf + alphaY * lowerHalf;
+          }
+        } else {
+          sample = otherImage.Pixel(x0, y0);
         }
+
+        Pixel(i, j) = opacity * sample + (1 - opacity) * newspaperColor;
       }
     }
   }
@@ -291,341 +409,706 @@ identifyCorners(std::vector<R2Image>& markers, std::vector<Point>& oldMarkerLoca
 }
 
 void R2Image::
-findMarkers(std::vector<R2Image>& markers, std::vector<Point>& markerLocations, std::vector<Point>& oldMarkerLocations) {
-   for (size_t i = 0; i < markers.size(); ++ i) {
-      // speed optimization: can safely step by an 8th of the marker without missing
-      R2Image& marker = markers[i];
-      int xStepSize = marker.Width() / 8;
-      int yStepSize = marker.Height() / 8;
-
-      int FINE_X = xStepSize * 2;
-      int FINE_Y = yStepSize * 2;
-
-      float bestSSD = marker.Width() * marker.Height() * 3;
-        int bestX = -1;
-        int bestY = -1;
-
-        
-        // use oldLocation to improve search speed
-        const int searchWidthReach = width * 0.05;
-        const int searchHeightReach = height * 0.05;
-        
-        const Point& oldLocation = oldMarkerLocations[i];
-        //printf("(%f, %f) \n", oldLocation.x, oldLocation.y);
-        
-        const bool pastLocExists = oldLocation.x != -1;
-        // initialize search bounds to 20% of image around
-        int xMin = pastLocExists ? oldLocation.x - searchWidthReach : width * 0.25; 
-        int xMax = pastLocExists ? oldLocation.x + searchWidthReach : width * 0.75; 
-        int yMin = pastLocExists ? oldLocation.y - searchHeightReach : height * 0; 
-        int yMax = pastLocExists ? oldLocation.y + searchHeightReach : height * 0.75; 
-        
-
-      // Iterate over image
-       while (xStepSize != 0) {
-         // SEARCH BOX VISUALIZATION
-         //drawSquare(xMin, yMin, xMax, yMax, 0, 0, 1);
-          // printf("xStep: %d    yStep: %d\n", xStepSize, yStepSize);
-        for (int x = xMin; x < xMax; x += xStepSize) {
-          //printf("Reached row %d... \n", x + 1);
-          for (int y = yMin; y < yMax; y += yStepSize) {
-            // See if point is better match for any of markers
-            const float ssd = calculateSSD(x, y, marker);
-            if (ssd < bestSSD) {
-                //printf("Marker %d Better ssd: %f... \n", i + 1, ssd);
-                //printf("Better ssd: %f... \n", ssd);
-                bestSSD = ssd;
-                bestX = x;
-                bestY = y;
-            }
-          }
-        }
-
-        if (xStepSize == 1 && yStepSize == 1) {
-          xStepSize = 0;
-          yStepSize = 0;
-        } else {
-          xStepSize = (xStepSize > 1) ? xStepSize / 2 : 1;
-          yStepSize = (yStepSize > 1) ? yStepSize / 2 : 1;
-          FINE_X = xStepSize * 2;
-          FINE_Y = yStepSize * 2;
-
-          xMin = fmax(0, bestX - FINE_X);
-          xMax = fmin(width, bestX + FINE_X);
-          yMin = fmax(0, bestY - FINE_Y);
-          yMax = fmin(height, bestY + FINE_Y);
-        }
-      }
-      markerLocations.push_back(Point(bestX, bestY));
-    }
+identifyCorners(std::vector<R2Image>& markers, std::vector<Point>& oldMarkerLocations, std::vector<MarkerTrack>& tracks) {
+  // Same with every marker searched where its track predicts it
+  std::vector<Point> markerLocations;
+  findMarkers(markers, markerLocations, tracks);
+  for (size_t i = 0; i < markerLocations.size(); i++) {
+    oldMarkerLocations[i] = markerLocations[i];
+  }
 }
 
+// Candidate match of the coarse-to-fine marker search (position in level pixels)
+struct MarkerCandidate {
+  float ssd;
+  int x;
+  int y;
 
+  MarkerCandidate(float s, int xi, int yi) : ssd(s), x(xi), y(yi) {}
 
-// void* globalHelper(void * inputPointer) {
-//   // printf("entering globalHelper\n");
-//   // speed optimization: can safely step by an 8th of the marker without missing
-
-//   R2Image::Marker* markerPointer = (R2Image::Marker*)inputPointer;
+  bool operator<(const MarkerCandidate& candidate) const {
+    return ssd < candidate.ssd;
+  }
+};
 
-//   R2Image*             frame          = markerPointer->frame;
-//   R2Image*             marker         = markerPointer->marker;
-//   Point*               markerLocation = markerPointer->markerLocation; 
-//   Point*               oldLocation    = markerPointer->oldMarkerLocation;
-//   std::vector<Point*>* locs           = markerPointer->markerLocs;
-//   int                  i              = markerPointer->index;      
+static void
+keepBestCandidates(std::vector<MarkerCandidate>& candidates) {
+  // Best R2_MARKER_SEARCH_CANDIDATES distinct positions, best first
+  std::sort(candidates.begin(), candidates.end());
+  std::vector<MarkerCandidate> kept;
+  for (size_t i = 0; (i < candidates.size()) && (kept.size() < R2_MARKER_SEARCH_CANDIDATES); i++) {
+    bool duplicate = false;
+    for (size_t k = 0; k < kept.size(); k++) {
+      if ((kept[k].x == candidates[i].x) && (kept[k].y == candidates[i].y)) duplicate = true;
+    }
+    if (!duplicate) kept.push_back(candidates[i]);
+  }
+  candidates.swap(kept);
+}
 
-//   size_t width  = frame->Width();
-//   size_t height = frame->Height();
+static void
+collectMarkerMinima(const std::vector<float>& ssds, int w, int h, int j, int xMin, int yMin, std::vector<MarkerCandidate>& candidates) {
+  // Positions of row j no 3x3 neighbor beats
+  for (int i = 0; i < w; i++) {
+    const float ssd = ssds[j * w + i];
+    bool minimum = true;
+    for (int dj = -1; (dj <= 1) && minimum; dj++) {
+      for (int di = -1; di <= 1; di++) {
+        if ((i + di < 0) || (i + di >= w) || (j + dj < 0) || (j + dj >= h)) continue;
+        if (ssds[(j + dj) * w + (i + di)] < ssd) minimum = false;
+      }
+    }
+    if (minimum) candidates.push_back(MarkerCandidate(ssd, xMin + i, yMin + j));
+  }
+}
+
+// Search of one marker: exhaustive over a box of its coarsest pyramid level (in
+// level pixels), then refined down to the finest
+struct MarkerSearch {
+  const R2Pyramid *framePyramid;
+  const R2Pyramid *markerPyramid;
+  int coarsest;
+  int xMin, yMin, xMax, yMax;
+  std::vector<MarkerCandidate> candidates;
+
+  // Direct search state: ssds of the box, rows to compare first, and the lowest
+  // bound any band has reached (each band's worst settled minimum is at least the
+  // final worst candidate, so any of them can bound the others)
+  std::vector<float> ssds;
+  std::vector<int> rowOrder;
+  std::atomic<float> bound;
+
+  // Matching by NCC: standardized marker levels, and summed area tables of the
+  // frame levels (NULL when matching by ssd)
+  std::vector<R2LuminanceImage> standardized;
+  const std::vector<R2SummedAreaTable> *tables;
+
+  // Direct search by ssd: the coarsest marker level quantized to 8-bit luma for
+  // the integer ssd (empty when matching by NCC or by FFT)
+  R2ByteImage markerBytes;
+
+  // Positions looked at and given up on part way (added to the totals afterwards)
+  long positions;
+  long pruned;
+};
+
+// Band of rows [yMin, yMax) of the union of the boxes of markers searched at the
+// same level of the same pyramid, with its own bound and settled minima per marker
+struct MarkerSearchTile {
+  const R2PlanarImage *frame;
+  const R2ByteImage *frameBytes;
+  std::vector<MarkerSearch *> searches;
+  int xMin, yMin, xMax, yMax;
+  std::vector<float> bounds;
+  std::vector<long> pruned;
+  std::vector<std::vector<MarkerCandidate> > candidates;
+};
+
+static const R2PlanarImage&
+searchedMarker(const MarkerSearch& search, int level) {
+  // Marker level the search compares windows with
+  return search.tables ? search.standardized[level] : search.markerPyramid->Level(level);
+}
+
+static const R2SummedAreaTable *
+searchedTable(const MarkerSearch& search, int level) {
+  // Table of the frame level when matching by NCC
+  return search.tables ? &(*search.tables)[level] : NULL;
+}
+
+static float
+matchMarker(const R2PlanarImage& frame, int x, int y, const R2PlanarImage& marker, const R2SummedAreaTable *table, const int *rowOrder, float bound) {
+  // Bounded ssd of the window at (x, y), standardized first when there is a table
+  return table ? frame.calculateNCC(x, y, marker, *table, rowOrder, bound) : frame.calculateSSD(x, y, marker, rowOrder, bound);
+}
+
+static bool
+settlesInTile(const MarkerSearch& search, int y, int tileYMin, int tileYMax) {
+  // Whether the rows next to box row y are inside the band (or past the box)
+  return ((y == search.yMin) || (y - 1 >= tileYMin)) && ((y == search.yMax - 1) || (y + 1 < tileYMax));
+}
+
+static void
+settleMarkerRow(MarkerSearch& search, int y, std::vector<MarkerCandidate>& candidates, float& bound) {
+  // Local minima of box row y (its neighbor rows are done) join the candidates, and
+  // once there are enough of them the worst bounds the ssds still to come here and,
+  // when lower than theirs, in the other bands
+  const int w = search.xMax - search.xMin;
+  const int h = search.yMax - search.yMin;
+  collectMarkerMinima(search.ssds, w, h, y - search.yMin, search.xMin, search.yMin, candidates);
+  keepBestCandidates(candidates);
+  if (candidates.size() < R2_MARKER_SEARCH_CANDIDATES) return;
+  bound = candidates.back().ssd;
+  float shared = search.bound.load();
+  while ((bound < shared) && !search.bound.compare_exchange_weak(shared, bound)) {}
+}
+
+static void
+searchMarkerSurface(void *data) {
+  // Whole box at once with FFT correlation, then its best local minima
+  MarkerSearch& search = *(MarkerSearch *) data;
+  const int w = search.xMax - search.xMin;
+  const int h = search.yMax - search.yMin;
+  const R2PlanarImage& frame = search.framePyramid->Level(search.coarsest);
+  const R2PlanarImage& marker = searchedMarker(search, search.coarsest);
+  if (search.tables) frame.calculateNCCSurface(search.xMin, search.yMin, search.xMax, search.yMax, marker, *searchedTable(search, search.coarsest), search.ssds.data());
+  else frame.calculateSSDSurface(search.xMin, search.yMin, search.xMax, search.yMax, marker, search.ssds.data());
+  for (int j = 0; j < h; j++) collectMarkerMinima(search.ssds, w, h, j, search.xMin, search.yMin, search.candidates);
+  keepBestCandidates(search.candidates);
+}
+
+static void
+searchMarkerTile(void *data) {
+  // Direct SSDs of the band a row at a time, every marker in turn at each position
+  // so the frame window under a position is loaded once for all of them. Minima
+  // of a row are settled once the row above it is done, and once there are enough
+  // of them, positions summing past the worst are dropped part way: their partial
+  // sum (still above it) stands in for the ssd, which is all the neighbor test and
+  // the final selection need. Rows on the edge of the band are settled afterwards.
+  // Which positions get dropped depends on how far the other bands are, the
+  // candidates that come out do not. Matching by ssd, windows are compared on
+  // 8-bit luma with integer sums.
+  MarkerSearchTile& tile = *(MarkerSearchTile *) data;
+  const R2PlanarImage& frame = *tile.frame;
+  for (int y = tile.yMin; y < tile.yMax; y++) {
+    for (int x = tile.xMin; x < tile.xMax; x++) {
+      for (size_t k = 0; k < tile.searches.size(); k++) {
+        MarkerSearch& search = *tile.searches[k];
+        if ((x < search.xMin) || (x >= search.xMax) || (y < search.yMin) || (y >= search.yMax)) continue;
+        const float bound = std::min(tile.bounds[k], search.bound.load(std::memory_order_relaxed));
+        const float ssd = tile.frameBytes ? tile.frameBytes->calculateSSD(x, y, search.markerBytes, search.rowOrder.data(), bound) :
+          matchMarker(frame, x, y, searchedMarker(search, search.coarsest), searchedTable(search, search.coarsest), search.rowOrder.data(), bound);
+        if (ssd > bound) tile.pruned[k]++;
+        search.ssds[(y - search.yMin) * (search.xMax - search.xMin) + (x - search.xMin)] = ssd;
+      }
+    }
+    for (size_t k = 0; k < tile.searches.size(); k++) {
+      MarkerSearch& search = *tile.searches[k];
+      if ((y < search.yMin) || (y >= search.yMax)) continue;
+      if ((y - 1 >= std::max(search.yMin, tile.yMin)) && settlesInTile(search, y - 1, tile.yMin, tile.yMax)) {
+        settleMarkerRow(search, y - 1, tile.candidates[k], tile.bounds[k]);
+      }
+      if ((y == search.yMax - 1) && settlesInTile(search, y, tile.yMin, tile.yMax)) {
+        settleMarkerRow(search, y, tile.candidates[k], tile.bounds[k]);
+      }
+    }
+  }
+}
 
-//   int xStepSize = marker->Width() / 8;
-//   int yStepSize = marker->Height() / 8;
+static void
+refineMarkerCandidates(const R2PlanarImage& frame, const R2PlanarImage& marker, const R2SummedAreaTable *table, std::vector<MarkerCandidate>& candidates, long& positions, long& pruned) {
+  // Candidates from the next coarser level, moved to this level and searched
+  // within R2_MARKER_SEARCH_RADIUS of there (positions stop summing once they
+  // are worse than the best one so far)
+  const int r = R2_MARKER_SEARCH_RADIUS;
+  std::vector<int> rowOrder(marker.Height() * std::min(marker.NChannels(), 3));
+  marker.calculateSSDRowOrder(rowOrder.data());
+  for (size_t k = 0; k < candidates.size(); k++) {
+    MarkerCandidate& candidate = candidates[k];
+    const int xCenter = 2 * candidate.x;
+    const int yCenter = 2 * candidate.y;
+    candidate = MarkerCandidate(FLT_MAX, xCenter, yCenter);
+    for (int y = yCenter - r; y <= yCenter + r; y++) {
+      for (int x = xCenter - r; x <= xCenter + r; x++) {
+        const float ssd = matchMarker(frame, x, y, marker, table, rowOrder.data(), candidate.ssd);
+        if (ssd > candidate.ssd) pruned++;
+        else if (ssd < candidate.ssd) candidate = MarkerCandidate(ssd, x, y);
+      }
+    }
+  }
+  positions += (long) candidates.size() * (2 * r + 1) * (2 * r + 1);
+  keepBestCandidates(candidates);
+}
 
-//   int FINE_X = xStepSize * 2;
-//   int FINE_Y = yStepSize * 2;
+static void
+refineMarkerSearch(void *data) {
+  // Carry the best candidates down, refining at every level
+  MarkerSearch& search = *(MarkerSearch *) data;
+  for (int level = search.coarsest - 1; level >= 0; level--) {
+    refineMarkerCandidates(search.framePyramid->Level(level), searchedMarker(search, level), searchedTable(search, level), search.candidates, search.positions, search.pruned);
+  }
+}
 
-//   float bestSSD = marker->Width() * marker->Height() * 3;
-//     int bestX = -1;
-//     int bestY = -1;
+static void
+runMarkerTasks(std::vector<R2WorkerTask>& tasks) {
+  // On the shared worker pool in multi thread mode, else one after another here
+  // (tasks write disjoint results, so both give the same ones)
+  if (MULTI_THREAD) {
+    R2WorkerPool::SharedPool().Run(tasks.data(), tasks.size());
+  }
+  else {
+    for (size_t i = 0; i < tasks.size(); i++) tasks[i].function(tasks[i].data);
+  }
+}
+
+static void
+searchMarkers(std::vector<MarkerSearch>& searches) {
+  // Exhaustive search of every box and refinement of every marker as worker tasks.
+  // Markers whose box is big enough for FFT correlation get their own surface. The
+  // others are searched together per level and pyramid, in bands of
+  // R2_MARKER_SEARCH_TILE_ROWS or more rows, so one pass over the frame serves all
+  // of them and a big window is split between threads. Bands do not depend on the
+  // number of threads, so neither do the results.
+  const int numMarkers = searches.size();
+  std::vector<R2WorkerTask> tasks;
+  std::vector<MarkerSearch *> direct;
+  for (int i = 0; i < numMarkers; ++ i) {
+    MarkerSearch& search = searches[i];
+    const R2PlanarImage& marker = searchedMarker(search, search.coarsest);
+    const int w = search.xMax - search.xMin;
+    const int h = search.yMax - search.yMin;
+    search.positions = search.pruned = 0;
+    if ((w <= 0) || (h <= 0)) continue;
+    search.ssds.resize(w * h);
+
+    // FFT correlation when direct SSDs would touch many more pixels than the transforms
+    const double directCost = (double) w * h * marker.Width() * marker.Height();
+    const double transformSize = (double) R2FFTSize(w + marker.Width() - 1) * R2FFTSize(h + marker.Height() - 1);
+    if (directCost > R2_MARKER_SEARCH_FFT_RATIO * transformSize * log2(transformSize)) {
+      R2WorkerTask task = { searchMarkerSurface, &search };
+      tasks.push_back(task);
+      continue;
+    }
 
-//     // remove for final
-//     // const int a = ((i % 2) * width / 2);
-//     // const int b = width / (2 - (i % 2));
-//     // const int c = ((i / 2) * height / 2);
-//     // const int d = height / (2 - (i / 2));
-    
-//     // use oldLocation to improve search speed
-//     const int searchWidthReach = width * 0.1;
-//     const int searchHeightReach = height * 0.1;
-    
-//     // const Point& oldLocation = oldMarkerLocations[i];
-//     //printf("(%f, %f) \n", oldLocation.x, oldLocation.y);
-    
-//     const bool pastLocExists = oldLocation->x != -1;
-//     // initialize search bounds to 20% of image around
-//     int xMin = pastLocExists ? oldLocation->x - searchWidthReach : 0; //CHANGE TO 0
-//     int xMax = pastLocExists ? oldLocation->x + searchWidthReach : width; //CHANGE TO width
-//     int yMin = pastLocExists ? oldLocation->y - searchHeightReach : 0; //CHANGE TO 0
-//     int yMax = pastLocExists ? oldLocation->y + searchHeightReach : height; //CHANGE TO height
-    
-//   // printf("setup complete\n");
-
-//   // Iterate over image
-//   while (xStepSize != 0) {
-//     // printf("xStep: %d    yStep: %d\n", xStepSize, yStepSize);
-//     for (int x = xMin; x < xMax; x += xStepSize) {
-//       //printf("Reached row %d... \n", x + 1);
-//       for (int y = yMin; y < yMax; y += yStepSize) {
-//         // See if point is better match for any of markers
-//         const float ssd = frame->calculateSSD(x, y, *marker);
-//         if (ssd < bestSSD) {
-//             //printf("Marker %d Better ssd: %f... \n", i + 1, ssd);
-//             //printf("Better ssd: %f... \n", ssd);
-//             bestSSD = ssd;
-//             bestX = x;
-//             bestY = y;
-//         }
-//       }
-//     }
-
-//     if (xStepSize == 1 && yStepSize == 1) {
-//       xStepSize = 0;
-//       yStepSize = 0;
-//     } else {
-//       xStepSize = (xStepSize > 1) ? xStepSize / 2 : 1;
-//       yStepSize = (yStepSize > 1) ? yStepSize / 2 : 1;
-//       FINE_X = xStepSize * 2;
-//       FINE_Y = yStepSize * 2;
-
-//       xMin = fmax(0, bestX - FINE_X);
-//       xMax = fmin(width, bestX + FINE_X);
-//       yMin = fmax(0, bestY - FINE_Y);
-//       yMax = fmin(height, bestY + FINE_Y);
-//     }
-//   }
+    search.rowOrder.resize(marker.Height() * std::min(marker.NChannels(), 3));
+    marker.calculateSSDRowOrder(search.rowOrder.data());
+    if (!search.tables) search.markerBytes.FromLuminance(marker);
+    search.positions = (long) w * h;
+    search.bound = FLT_MAX;
+    direct.push_back(&search);
+  }
+
+  // Bands of the union box of each group of direct searches (its frame level
+  // quantized once for all of them when matching by ssd)
+  std::list<MarkerSearchTile> tiles;
+  std::list<R2ByteImage> frameBytes;
+  std::vector<bool> grouped(direct.size(), false);
+  for (size_t i = 0; i < direct.size(); ++ i) {
+    if (grouped[i]) continue;
+    std::vector<MarkerSearch *> group;
+    int unionBox[4] = { direct[i]->xMin, direct[i]->yMin, direct[i]->xMax, direct[i]->yMax };
+    for (size_t k = i; k < direct.size(); ++ k) {
+      if (grouped[k] || (direct[k]->framePyramid != direct[i]->framePyramid) || (direct[k]->coarsest != direct[i]->coarsest)) continue;
+      group.push_back(direct[k]);
+      grouped[k] = true;
+      unionBox[0] = std::min(unionBox[0], direct[k]->xMin);
+      unionBox[1] = std::min(unionBox[1], direct[k]->yMin);
+      unionBox[2] = std::max(unionBox[2], direct[k]->xMax);
+      unionBox[3] = std::max(unionBox[3], direct[k]->yMax);
+    }
+    const R2PlanarImage& frame = direct[i]->framePyramid->Level(direct[i]->coarsest);
+    const R2ByteImage *bytes = NULL;
+    if (!direct[i]->tables) {
+      frameBytes.push_back(R2ByteImage());
+      frameBytes.back().FromLuminance(frame);
+      bytes = &frameBytes.back();
+    }
+    const int ntiles = std::max(1, (unionBox[3] - unionBox[1]) / R2_MARKER_SEARCH_TILE_ROWS);
+    for (int t = 0; t < ntiles; t++) {
+      tiles.push_back(MarkerSearchTile());
+      MarkerSearchTile& tile = tiles.back();
+      tile.frame = &frame;
+      tile.frameBytes = bytes;
+      tile.searches = group;
+      tile.xMin = unionBox[0];
+      tile.xMax = unionBox[2];
+      tile.yMin = unionBox[1] + (unionBox[3] - unionBox[1]) * t / ntiles;
+      tile.yMax = unionBox[1] + (unionBox[3] - unionBox[1]) * (t + 1) / ntiles;
+      tile.bounds.assign(group.size(), FLT_MAX);
+      tile.pruned.assign(group.size(), 0);
+      tile.candidates.resize(group.size());
+      R2WorkerTask task = { searchMarkerTile, &tile };
+      tasks.push_back(task);
+    }
+  }
+  runMarkerTasks(tasks);
+
+  // Minima settled in the bands, plus those of the rows on band edges
+  for (std::list<MarkerSearchTile>::iterator tile = tiles.begin(); tile != tiles.end(); ++tile) {
+    for (size_t k = 0; k < tile->searches.size(); k++) {
+      MarkerSearch& search = *tile->searches[k];
+      std::vector<MarkerCandidate>& candidates = search.candidates;
+      candidates.insert(candidates.end(), tile->candidates[k].begin(), tile->candidates[k].end());
+      const int edges[2] = { tile->yMin, tile->yMax - 1 };
+      for (int e = 0; e < ((tile->yMax - 1 > tile->yMin) ? 2 : 1); e++) {
+        const int y = edges[e];
+        if ((y < search.yMin) || (y >= search.yMax) || settlesInTile(search, y, tile->yMin, tile->yMax)) continue;
+        collectMarkerMinima(search.ssds, search.xMax - search.xMin, search.yMax - search.yMin, y - search.yMin, search.xMin, search.yMin, candidates);
+      }
+      search.pruned += tile->pruned[k];
+    }
+  }
+  for (size_t k = 0; k < direct.size(); ++ k) keepBestCandidates(direct[k]->candidates);
 
-  // make new search window around best SSD 
-  // TODO: will this give us issues re: local minima?
-  // TODO: recursive descent
-  // const size_t lowX = fmax(0, bestX - FINE_X);
-  // const size_t hiX  = fmin (width, bestX + FINE_X);
-  // const size_t lowY = fmax(0, bestY - FINE_Y);
-  // const size_t hiY  = fmin (height, bestY + FINE_Y);
-
-  // for (int x = lowX; x < hiX; ++ x) {
-  //   for (int y = lowY; y < hiY; ++y) {
-  //       // See if point is better match for any of markers
-  //     const float ssd = calculateSSD(x, y, marker);
-  //     if (ssd < bestSSD) {
-  //       //printf("Marker %d Better ssd: %f... \n", i + 1, ssd);      
-  //       bestSSD = ssd;
-  //       bestX = x;
-  //       bestY = y;
-  //     }
-  //   }
-  // }
-
-//   // printf("match found\n");
-//   (*locs)[i] = new Point(bestX, bestY);
-//   // printf("wrote marker location\n");
-//   return NULL;
-// }
+  // Refine every marker
+  tasks.clear();
+  for (int i = 0; i < numMarkers; ++ i) {
+    R2WorkerTask task = { refineMarkerSearch, &searches[i] };
+    tasks.push_back(task);
+  }
+  runMarkerTasks(tasks);
 
+  for (int i = 0; i < numMarkers; ++ i) {
+    SSD_CANDIDATES += searches[i].positions;
+    SSD_PRUNED += searches[i].pruned;
+  }
+}
 
+void R2Image::
+findMarkers(std::vector<R2Image>& markers, std::vector<Point>& markerLocations, std::vector<Point>& oldMarkerLocations) {
+   // use oldLocation to improve search speed
+   const int searchWidthReach = width * 0.05;
+   const int searchHeightReach = height * 0.05;
+   const int numMarkers = markers.size();
+
+   // Search box of every marker (xMin, yMin, xMax, yMax, clipped to the frame)
+   std::vector<int> boxes(4 * numMarkers);
+   for (int i = 0; i < numMarkers; ++ i) {
+      const Point& oldLocation = oldMarkerLocations[i];
+
+      const bool pastLocExists = oldLocation.x != -1;
+      // initialize search bounds to 20% of image around
+      int *box = &boxes[4 * i];
+      box[0] = fmax(0, pastLocExists ? oldLocation.x - searchWidthReach : width * 0.25);
+      box[1] = fmax(0, pastLocExists ? oldLocation.y - searchHeightReach : height * 0);
+      box[2] = fmin(width, pastLocExists ? oldLocation.x + searchWidthReach : width * 0.75);
+      box[3] = fmin(height, pastLocExists ? oldLocation.y + searchHeightReach : height * 0.75);
+   }
+
+   std::vector<Point> locations;
+   std::vector<float> ssds;
+   findMarkersInBoxes(markers, boxes, locations, ssds);
+   markerLocations.insert(markerLocations.end(), locations.begin(), locations.end());
+}
+
+static void
+updateMarkerTrack(MarkerTrack& track, const Point& location, float ssd) {
+  // Filter the new match into the track (a lost marker starts over)
+  if (location.x == -1) {
+    track = MarkerTrack();
+    return;
+  }
+  if (track.nframes == 0) {
+    track.position = location;
+    track.ssd = ssd;
+  }
+  else {
+    const Point predicted = track.position + track.velocity;
+    const Point residual(location.x - predicted.x, location.y - predicted.y);
+    const double a = R2_MARKER_TRACK_ALPHA;
+    const double b = (track.nframes == 1) ? 1.0 : R2_MARKER_TRACK_BETA;
+    const double d = R2_MARKER_TRACK_DECAY;
+    track.position = Point(predicted.x + a * residual.x, predicted.y + a * residual.y);
+    track.velocity = Point(track.velocity.x + b * residual.x, track.velocity.y + b * residual.y);
+    track.error = Point((1 - d) * track.error.x + d * fabs(residual.x), (1 - d) * track.error.y + d * fabs(residual.y));
+    track.ssd = (1 - d) * track.ssd + d * ssd;
+  }
+  track.nframes++;
+}
 
-// void R2Image::
-// findMarkers(std::vector<R2Image>& markers, std::vector<Point>& markerLocations, std::vector<Point>& oldMarkerLocations) {
-//   // It is slower to multithread after the first images once we have rough marker locations to search from
-//   //bool firstPass = true;//markerLocations[0].x == -1;
-//   // for (int i = 0; i < markerLocations.size(); i++) {
-//   //   allPastLocationsExist = markerLocations[i].x != -1;
-//   // }
-  
+bool R2Image::
+trackMarker(R2Image& marker, const MarkerTrack& track, int xReach, int yReach, Point& location, float& ssd) {
+   // Lucas-Kanade from the predicted position, over a pyramid of the part of the
+   // frame the marker can get to, then down the ssd to the local minimum next to it
+   // (the integer position the search would settle on)
+   const int mw = marker.Width();
+   const int mh = marker.Height();
+   const int xPredicted = round(track.position.x + track.velocity.x);
+   const int yPredicted = round(track.position.y + track.velocity.y);
+   const int region[4] = { std::max(0, xPredicted - xReach - mw / 2 - 1), std::max(0, yPredicted - yReach - mh / 2 - 1),
+                           std::min(width, xPredicted + xReach + mw - mw / 2 + 1), std::min(height, yPredicted + yReach + mh - mh / 2 + 1) };
+   if ((region[2] - region[0] <= mw) || (region[3] - region[1] <= mh)) return false;
+
+   // As coarse as the search would start, so the same motion is in reach
+   const int reach = std::max(xReach, yReach);
+   int level = 0;
+   while (((mw >> (level + 1)) >= R2_MARKER_SEARCH_MIN_SIZE) && ((mh >> (level + 1)) >= R2_MARKER_SEARCH_MIN_SIZE) &&
+          ((reach >> level) > R2_MARKER_SEARCH_RADIUS)) level++;
+   const R2Pyramid pyramid(static_cast<const R2Image&>(*this).View(region[0], region[1], region[2] - region[0], region[3] - region[1]), level + 1);
+   const R2Pyramid& markerPyramid = marker.Pyramid(level + 1);
+   double x = track.position.x + track.velocity.x - mw / 2 - region[0];
+   double y = track.position.y + track.velocity.y - mh / 2 - region[1];
+   if (!pyramid.Track(markerPyramid, level, x, y)) return false;
+
+   // Marker compared the way the search does (standardized when matching by NCC)
+   const R2LuminanceImage& image = pyramid.Level(0);
+   R2LuminanceImage templ(markerPyramid.Level(0));
+   R2SummedAreaTable table;
+   if (MARKER_NCC) {
+     templ.Standardize();
+     table.Build(image);
+   }
+   std::vector<int> rowOrder(templ.Height());
+   templ.calculateSSDRowOrder(rowOrder.data());
+   int xBest = round(x) + mw / 2;
+   int yBest = round(y) + mh / 2;
+   float best = matchMarker(image, xBest, yBest, templ, MARKER_NCC ? &table : NULL, rowOrder.data(), FLT_MAX);
+   bool moved = true;
+   for (int step = 0; moved && (step <= R2_MARKER_TRACK_LK_STEPS); step++) {
+      moved = false;
+      const int xCenter = xBest;
+      const int yCenter = yBest;
+      for (int dy = -1; dy <= 1; dy++) {
+        for (int dx = -1; dx <= 1; dx++) {
+          const float candidate = matchMarker(image, xCenter + dx, yCenter + dy, templ, MARKER_NCC ? &table : NULL, rowOrder.data(), best);
+          if (candidate < best) {
+            best = candidate;
+            xBest = xCenter + dx;
+            yBest = yCenter + dy;
+            moved = true;
+          }
+        }
+      }
+   }
 
-//   if (MULTI_THREAD) {
-//     std::vector<pthread_t> pth;
-//     std::vector<Point*> locs;
-
-//     for (int i = 0; i < markers.size(); i++) {
-//       pthread_t p;
-
-//       pth.push_back(p);
-//       locs.push_back(new Point(-1, -1));
-
-//       pthread_create(&pth[i], NULL, globalHelper, 
-//         (void*)(new Marker(this, &markers[i], &markerLocations[i], &oldMarkerLocations[i], &locs, i)));
-//     }
-
-//     for (size_t i = 0; i < 4; ++i) {
-//       // printf("joining thread %d\n", i);
-//       pthread_join(pth[i], NULL);
-//       // printf("joined thread %d\n", i);
-//       markerLocations.push_back(*(locs[i]));
-//       assert(markerLocations[i].x != -1);
-//     }
-//   } 
-//   else 
-//   {
-//     for (size_t i = 0; i < markers.size(); ++ i) {
-//       // speed optimization: can safely step by an 8th of the marker without missing
-//       R2Image& marker = markers[i];
-//       int xStepSize = marker.Width() / 8;
-//       int yStepSize = marker.Height() / 8;
-
-//       int FINE_X = xStepSize * 2;
-//       int FINE_Y = yStepSize * 2;
-
-//       float bestSSD = marker.Width() * marker.Height() * 3;
-//         int bestX = -1;
-//         int bestY = -1;
-
-//         // remove for final
-//         // const int a = ((i % 2) * width / 2);
-//         // const int b = width / (2 - (i % 2));
-//         // const int c = ((i / 2) * height / 2);
-//         // const int d = height / (2 - (i / 2));
-        
-//         // use oldLocation to improve search speed
-//         const int searchWidthReach = width * 0.1;
-//         const int searchHeightReach = height * 0.1;
-        
-//         const Point& oldLocation = oldMarkerLocations[i];
-//         //printf("(%f, %f) \n", oldLocation.x, oldLocation.y);
-        
-//         const bool pastLocExists = oldLocation.x != -1;
-//         // initialize search bounds to 20% of image around
-//         int xMin = pastLocExists ? oldLocation.x - searchWidthReach : 0; 
-//         int xMax = pastLocExists ? oldLocation.x + searchWidthReach : width; 
-//         int yMin = pastLocExists ? oldLocation.y - searchHeightReach : 0; 
-//         int yMax = pastLocExists ? oldLocation.y + searchHeightReach : height; 
-        
-
-//       // Iterate over image
-//        while (xStepSize != 0) {
-//          // SEARCH BOX VISUALIZATION
-//          drawSquare(xMin, yMin, xMax, yMax, 0, 0, 1);
-//           // printf("xStep: %d    yStep: %d\n", xStepSize, yStepSize);
-//         for (int x = xMin; x < xMax; x += xStepSize) {
-//           //printf("Reached row %d... \n", x + 1);
-//           for (int y = yMin; y < yMax; y += yStepSize) {
-//             // See if point is better match for any of markers
-//             const float ssd = calculateSSD(x, y, marker);
-//             if (ssd < bestSSD) {
-//                 //printf("Marker %d Better ssd: %f... \n", i + 1, ssd);
-//                 //printf("Better ssd: %f... \n", ssd);
-//                 bestSSD = ssd;
-//                 bestX = x;
-//                 bestY = y;
-//             }
-//           }
-//         }
-
-//         if (xStepSize == 1 && yStepSize == 1) {
-//           xStepSize = 0;
-//           yStepSize = 0;
-//         } else {
-//           xStepSize = (xStepSize > 1) ? xStepSize / 2 : 1;
-//           yStepSize = (yStepSize > 1) ? yStepSize / 2 : 1;
-//           FINE_X = xStepSize * 2;
-//           FINE_Y = yStepSize * 2;
-
-//           xMin = fmax(0, bestX - FINE_X);
-//           xMax = fmin(width, bestX + FINE_X);
-//           yMin = fmax(0, bestY - FINE_Y);
-//           yMax = fmin(height, bestY + FINE_Y);
-//         }
-//       }
-
-//       // make new search window around best SSD 
-//       // TODO: will this give us issues re: local minima?
-//       // TODO: recursive descent
-//       // const size_t lowX = fmax(0, bestX - FINE_X);
-//       // const size_t hiX  = fmin (width, bestX + FINE_X);
-//       // const size_t lowY = fmax(0, bestY - FINE_Y);
-//       // const size_t hiY  = fmin (height, bestY + FINE_Y);
-   
-//       // for (int x = lowX; x < hiX; ++ x) {
-//       //   for (int y = lowY; y < hiY; ++y) {
-//       //       // See if point is better match for any of markers
-//       //     const float ssd = calculateSSD(x, y, marker);
-//       //     if (ssd < bestSSD) {
-//       //       //printf("Marker %d Better ssd: %f... \n", i + 1, ssd);      
-//       //       bestSSD = ssd;
-//       //       bestX = x;
-//       //       bestY = y;
-//       //     }
-//       //   }
-//       // }
-
-//       markerLocations.push_back(Point(bestX, bestY));
-//     }
-//   }
-// }
+   // Only trust it when it was next to a minimum, stays within reach and is about as
+   // good as usual
+   if (moved) return false;
+   if ((abs(xBest + region[0] - xPredicted) > xReach) || (abs(yBest + region[1] - yPredicted) > yReach)) return false;
+   if (best > R2_MARKER_TRACK_SSD_GROWTH * track.ssd) return false;
+   location = Point(xBest + region[0], yBest + region[1]);
+   ssd = best;
+   return true;
+}
 
-float R2Image::
-calculateSSD(const int x0, const int y0, R2Image& marker) {
-  const int xReach = marker.Width() / 2;
-  const int yReach = marker.Height() / 2;
+void R2Image::
+findMarkers(std::vector<R2Image>& markers, std::vector<Point>& markerLocations, std::vector<MarkerTrack>& tracks) {
+   // Markers with a velocity are searched around their predicted position, as far
+   // as they have recently been mispredicted by, the others as untracked
+   const int searchWidthReach = width * 0.05;
+   const int searchHeightReach = height * 0.05;
+   const int numMarkers = markers.size();
+   tracks.resize(numMarkers);
+
+   std::vector<Point> locations(numMarkers, Point(-1, -1));
+   std::vector<float> ssds(numMarkers, FLT_MAX);
+   std::vector<int> boxes(4 * numMarkers);
+   std::vector<int> xReaches(numMarkers), yReaches(numMarkers);
+   std::vector<bool> pending(numMarkers, true);
+   for (int i = 0; i < numMarkers; ++ i) {
+      const MarkerTrack& track = tracks[i];
+      xReaches[i] = std::min(searchWidthReach, std::max(R2_MARKER_TRACK_MIN_REACH, (int) ceil(R2_MARKER_TRACK_ERROR_GAIN * track.error.x)));
+      yReaches[i] = std::min(searchHeightReach, std::max(R2_MARKER_TRACK_MIN_REACH, (int) ceil(R2_MARKER_TRACK_ERROR_GAIN * track.error.y)));
+   }
+
+   // Markers Lucas-Kanade keeps hold of (within twice the reach, its steps are
+   // not limited to a box like the search) need no search
+   for (int i = 0; i < numMarkers; ++ i) {
+      MarkerTrack& track = tracks[i];
+      if (track.nframes < 2) continue;
+      if (track.searchFrames > 0) {
+        track.searchFrames--;
+        MARKERS_SEARCHED++;
+        continue;
+      }
+      const int xTrackReach = std::min(searchWidthReach, 2 * xReaches[i]);
+      const int yTrackReach = std::min(searchHeightReach, 2 * yReaches[i]);
+      if (!trackMarker(markers[i], track, xTrackReach, yTrackReach, locations[i], ssds[i])) {
+        track.searchFrames = R2_MARKER_TRACK_LK_WAIT;
+        MARKERS_SEARCHED++;
+        continue;
+      }
+      pending[i] = false;
+      MARKERS_TRACKED++;
+   }
+   bool searching = std::find(pending.begin(), pending.end(), true) != pending.end();
+
+   // Search the pending markers, and keep those whose best match is on the edge of
+   // the box (the marker probably moved further) or much worse than usual pending
+   // with twice the reach, until it gets to the untracked window
+   while (searching) {
+      for (int i = 0; i < numMarkers; ++ i) {
+        const MarkerTrack& track = tracks[i];
+        int *box = &boxes[4 * i];
+        box[0] = box[1] = box[2] = box[3] = 0;
+        if (!pending[i]) continue;
+        if (track.nframes < 2) {
+          const bool pastLocExists = track.nframes > 0;
+          box[0] = fmax(0, pastLocExists ? track.position.x - searchWidthReach : width * 0.25);
+          box[1] = fmax(0, pastLocExists ? track.position.y - searchHeightReach : height * 0);
+          box[2] = fmin(width, pastLocExists ? track.position.x + searchWidthReach : width * 0.75);
+          box[3] = fmin(height, pastLocExists ? track.position.y + searchHeightReach : height * 0.75);
+        }
+        else {
+          const int xPredicted = round(track.position.x + track.velocity.x);
+          const int yPredicted = round(track.position.y + track.velocity.y);
+          box[0] = std::max(0, xPredicted - xReaches[i]);
+          box[1] = std::max(0, yPredicted - yReaches[i]);
+          box[2] = std::min(width, xPredicted + xReaches[i] + 1);
+          box[3] = std::min(height, yPredicted + yReaches[i] + 1);
+        }
+      }
 
-  const int x1 = marker.Width() / 2;
-  const int y1 = marker.Height() / 2;
+      std::vector<Point> boxLocations;
+      std::vector<float> boxSSDs;
+      findMarkersInBoxes(markers, boxes, boxLocations, boxSSDs);
+
+      searching = false;
+      for (int i = 0; i < numMarkers; ++ i) {
+        if (!pending[i]) continue;
+        const MarkerTrack& track = tracks[i];
+        const int *box = &boxes[4 * i];
+        const Point& location = boxLocations[i];
+        if ((location.x != -1) && (boxSSDs[i] < ssds[i])) {
+          locations[i] = location;
+          ssds[i] = boxSSDs[i];
+        }
+        const bool onEdge = ((location.x <= box[0]) && (box[0] > 0)) || ((location.x >= box[2] - 1) && (box[2] < width)) ||
+                            ((location.y <= box[1]) && (box[1] > 0)) || ((location.y >= box[3] - 1) && (box[3] < height));
+        const bool widest = (track.nframes < 2) || ((xReaches[i] == searchWidthReach) && (yReaches[i] == searchHeightReach));
+        pending[i] = !widest && ((location.x == -1) || onEdge || (boxSSDs[i] > R2_MARKER_TRACK_SSD_GROWTH * track.ssd));
+        if (!pending[i]) continue;
+        xReaches[i] = std::min(searchWidthReach, 2 * xReaches[i]);
+        yReaches[i] = std::min(searchHeightReach, 2 * yReaches[i]);
+        searching = true;
+      }
+   }
 
-  float sum = 0;
+   for (int i = 0; i < numMarkers; ++ i) {
+      updateMarkerTrack(tracks[i], locations[i], ssds[i]);
+      markerLocations.push_back(locations[i]);
+   }
+}
 
-  for (int i = -xReach; i < xReach + 1; i++) {
-    for (int j = -yReach; j < yReach + 1; j++) {
-      // Don't have to check bounds for marker because work by construction
-      if (inBounds(x0 + i, y0 + j)) {
-          sum += ssd(Pixel(x0 + i, y0 + j), marker.Pixel(x1 + i, y1 + j));
-      } else {
-          // account for out of bounds pixels by adding max possible ssd
-          sum += 3;
+void R2Image::
+findMarkersInBoxes(std::vector<R2Image>& markers, const std::vector<int>& boxes, std::vector<Point>& markerLocations, std::vector<float>& markerSSDs) {
+   // Best match of every marker whose box (xMin, yMin, xMax, yMax, clipped to the
+   // frame) is not empty, with its ssd ((-1, -1) and FLT_MAX for the others)
+   const int numMarkers = markers.size();
+   markerLocations.assign(numMarkers, Point(-1, -1));
+   markerSSDs.assign(numMarkers, FLT_MAX);
+
+   // Coarsest pyramid level to search every box at (markers stay
+   // R2_MARKER_SEARCH_MIN_SIZE across there, and small boxes are not searched any
+   // coarser than R2_MARKER_SEARCH_RADIUS positions across), and the part of the
+   // frame its SSD windows can touch: the box grown by the marker extent plus how
+   // far refinement can wander from the box
+   std::vector<int> active;
+   std::vector<int> regions(4 * numMarkers);
+   std::vector<int> coarsestLevels(numMarkers);
+   int unionBox[4] = { width, height, 0, 0 };
+   long regionArea = 0;
+   int nlevels = 1;
+   for (int i = 0; i < numMarkers; ++ i) {
+      const R2Image& marker = markers[i];
+      const int *box = &boxes[4 * i];
+      if ((box[2] <= box[0]) || (box[3] <= box[1])) continue;
+      active.push_back(i);
+
+      const int reach = std::max(box[2] - box[0], box[3] - box[1]) / 2;
+      int level = 0;
+      while (((marker.Width() >> (level + 1)) >= R2_MARKER_SEARCH_MIN_SIZE) && ((marker.Height() >> (level + 1)) >= R2_MARKER_SEARCH_MIN_SIZE) &&
+             ((reach >> level) > R2_MARKER_SEARCH_RADIUS)) level++;
+      coarsestLevels[i] = level;
+      nlevels = std::max(nlevels, level + 1);
+      const int drift = (R2_MARKER_SEARCH_RADIUS + 1) << level;
+
+      int *region = &regions[4 * i];
+      region[0] = fmax(0, box[0] - drift - marker.Width() / 2);
+      region[1] = fmax(0, box[1] - drift - marker.Height() / 2);
+      region[2] = fmin(width, box[2] + drift + marker.Width() - marker.Width() / 2);
+      region[3] = fmin(height, box[3] + drift + marker.Height() - marker.Height() / 2);
+      if ((region[2] > region[0]) && (region[3] > region[1])) {
+        regionArea += (long) (region[2] - region[0]) * (region[3] - region[1]);
+        unionBox[0] = std::min(unionBox[0], region[0]);
+        unionBox[1] = std::min(unionBox[1], region[1]);
+        unionBox[2] = std::max(unionBox[2], region[2]);
+        unionBox[3] = std::max(unionBox[3], region[3]);
+      }
+   }
+   const int numActive = active.size();
+
+   // Luminance pyramids of just those regions: the frame's own (cached) pyramid when
+   // they cover most of the frame, else one of their bounding box when it is no
+   // bigger than building one per region (read views, so the cache is kept)
+   const R2Image& frame = *this;
+   const long unionArea = (long) std::max(unionBox[2] - unionBox[0], 0) * std::max(unionBox[3] - unionBox[1], 0);
+   const bool shareRegion = unionArea <= regionArea;
+   std::vector<R2Pyramid> regionPyramids;
+   std::vector<const R2Pyramid *> pyramids(numMarkers);
+   regionPyramids.reserve(numMarkers);
+   if (2 * std::min(unionArea, regionArea) >= (long) width * height) {
+      const R2Pyramid& framePyramid = Pyramid(nlevels);
+      for (int k = 0; k < numActive; ++ k) {
+        const int i = active[k];
+        regions[4 * i] = regions[4 * i + 1] = 0;
+        pyramids[i] = &framePyramid;
+      }
+   }
+   else if (shareRegion) {
+      regionPyramids.push_back(R2Pyramid(frame.View(unionBox[0], unionBox[1], unionBox[2] - unionBox[0], unionBox[3] - unionBox[1]), nlevels));
+      for (int k = 0; k < numActive; ++ k) {
+        const int i = active[k];
+        regions[4 * i] = unionBox[0];
+        regions[4 * i + 1] = unionBox[1];
+        pyramids[i] = &regionPyramids[0];
+      }
+   }
+   else {
+      for (int k = 0; k < numActive; ++ k) {
+        const int i = active[k];
+        const int *region = &regions[4 * i];
+        regionPyramids.push_back(R2Pyramid(frame.View(region[0], region[1], region[2] - region[0], region[3] - region[1]), coarsestLevels[i] + 1));
+        pyramids[i] = &regionPyramids.back();
+      }
+   }
+
+   // Box of every marker at its coarsest level (rounded outwards), in the coordinates
+   // of the pyramid it is searched in. Marker pyramids are cached on the markers,
+   // which stay the same every frame.
+   std::vector<MarkerSearch> searches(active.size());
+   for (int k = 0; k < numActive; ++ k) {
+      const int i = active[k];
+      MarkerSearch& search = searches[k];
+      search.framePyramid = pyramids[i];
+      search.markerPyramid = &markers[i].Pyramid(coarsestLevels[i] + 1);
+      search.coarsest = std::min(coarsestLevels[i], std::min(search.framePyramid->NLevels(), search.markerPyramid->NLevels()) - 1);
+      const int scale = 1 << search.coarsest;
+      const int *box = &boxes[4 * i];
+      search.xMin = (box[0] - regions[4 * i]) >> search.coarsest;
+      search.yMin = (box[1] - regions[4 * i + 1]) >> search.coarsest;
+      search.xMax = (box[2] - regions[4 * i] + scale - 1) >> search.coarsest;
+      search.yMax = (box[3] - regions[4 * i + 1] + scale - 1) >> search.coarsest;
+   }
+
+   // Matching by NCC, the marker levels standardized and one set of tables per
+   // pyramid, as deep as its deepest search
+   std::list<std::vector<R2SummedAreaTable> > frameTables;
+   for (int k = 0; k < numActive; ++ k) {
+      MarkerSearch& search = searches[k];
+      search.tables = NULL;
+      if (!MARKER_NCC) continue;
+      for (int level = 0; level <= search.coarsest; level++) {
+        search.standardized.push_back(search.markerPyramid->Level(level));
+        search.standardized.back().Standardize();
       }
+      for (int p = 0; (p < k) && !search.tables; ++ p) {
+        if (searches[p].framePyramid == search.framePyramid) search.tables = searches[p].tables;
+      }
+      if (search.tables) continue;
+      int nlevels = 0;
+      for (int p = k; p < numActive; ++ p) {
+        if (searches[p].framePyramid == search.framePyramid) nlevels = std::max(nlevels, searches[p].coarsest + 1);
+      }
+      frameTables.push_back(std::vector<R2SummedAreaTable>(nlevels));
+      for (int level = 0; level < nlevels; level++) frameTables.back()[level].Build(search.framePyramid->Level(level));
+      search.tables = &frameTables.back();
+   }
+
+   searchMarkers(searches);
+
+   for (int k = 0; k < numActive; ++ k) {
+      // nothing matched when the box was empty
+      const int i = active[k];
+      const std::vector<MarkerCandidate>& candidates = searches[k].candidates;
+      if (candidates.empty()) continue;
+      markerLocations[i] = Point(regions[4 * i] + candidates[0].x, regions[4 * i + 1] + candidates[0].y);
+      markerSSDs[i] = candidates[0].ssd;
     }
-  }
-  return sum;
 }
 
+
+
 ///////////////////////
 // Function Calls
 //////////////////////
@@ -673,6 +1156,8 @@ MatchHomography(R2Image& originalImage) {
   }
 
   // Compute homography matrix (this will be the matrix from original Image to this image as that is direction of feature matches)
+  // Left untransformed when too few matches were verified to fit one
+  if (goodMatches.size() < 4) return;
   std::vector<double> homographyMatrix;
   computeHomographyMatrixWithDLT(goodMatches, homographyMatrix);
   
@@ -695,12 +1180,22 @@ findMatches(const int numFeatures, const int numMatches, R2Image& originalImage,
   // Search for matches
   const double featureSearchAreaPercentage = 0.3; // Don't make this smaller is messes us tracking on the face image
   const int ssdSearchRadius = 3;
+  if (FEATURE_BRIEF) {
+    findDescriptorMatches(selectedFeatures, numMatches, minFeatureDistance, featureSearchAreaPercentage, originalImage, matches);
+    return;
+  }
+
+  // Pyramids of both images once for all features: this image's is built here,
+  // since the searches mark it (which would drop a cached one), originalImage's
+  // comes from its cache
+  const R2Pyramid pyramid(View(), R2_FEATURE_MATCH_LEVELS);
+  const R2Pyramid& featurePyramid = (&originalImage == this) ? pyramid : originalImage.Pyramid(R2_FEATURE_MATCH_LEVELS);
 
   for (int f = 0; f < selectedFeatures.size(); f++) {   
       if (f >= numMatches) {
        break;
      }
-      FeatureMatch match = findFeatureMatchConsecutiveImages(selectedFeatures[f], originalImage, featureSearchAreaPercentage, ssdSearchRadius);
+      FeatureMatch match = findFeatureMatchConsecutiveImages(selectedFeatures[f], pyramid, featurePyramid, featureSearchAreaPercentage, ssdSearchRadius);
       matches.push_back(match);
   }
 }
@@ -711,28 +1206,184 @@ findFeatureMatchConsecutiveImages(const Feature& feature, R2Image& featureImage,
   return findFeatureMatch(feature, featureImage, searchOrigin, searchAreaPercentage, ssdSearchRadius);
 }
 
+static void
+computeBriefDescriptors(const R2Image& image, const std::vector<Feature>& features, std::vector<R2BriefDescriptor>& descriptors) {
+  // Rotated BRIEF of every feature, on luminance blurred once for all of them
+  R2LuminanceImage blurred(image);
+  blurred.Blur(R2_BRIEF_SIGMA, false);
+  descriptors.resize(features.size());
+  for (size_t i = 0; i < features.size(); i++) {
+    const double angle = R2BriefOrientation(blurred, features[i].x, features[i].y);
+    R2BriefCompute(blurred, features[i].x, features[i].y, angle, descriptors[i]);
+  }
+}
+
+// Matches features of originalImage to features of this image by descriptor (the
+// match ssd is the Hamming distance), features without a candidate inside the
+// search area are left unmatched
+void R2Image::
+findDescriptorMatches(const std::vector<Feature>& features, const int numMatches, const int minFeatureDistance, const float searchAreaPercentage, R2Image& originalImage, std::vector<FeatureMatch>& matches) {
+  const int numFeatures = std::min((int) features.size(), numMatches);
+  std::vector<Feature> candidates;
+  findFeatures(R2_FEATURE_BRIEF_CANDIDATES * numFeatures, minFeatureDistance, false, *this, candidates);
+
+  // Descriptors are computed once per feature in each image
+  std::vector<R2BriefDescriptor> descriptors, candidateDescriptors;
+  computeBriefDescriptors(originalImage, features, descriptors);
+  computeBriefDescriptors(*this, candidates, candidateDescriptors);
+
+  // Nearest candidate inside the search area
+  const int searchWidthRadius = width * searchAreaPercentage / 2;
+  const int searchHeightRadius = height * searchAreaPercentage / 2;
+  const int numCandidates = candidates.size();
+  std::vector<int> distances(numCandidates);
+  for (int f = 0; f < numFeatures; f++) {
+    R2BriefDistances(descriptors[f], candidateDescriptors.data(), numCandidates, distances.data());
+    int best = -1;
+    for (int c = 0; c < numCandidates; c++) {
+      if (abs(candidates[c].x - features[f].x) >= searchWidthRadius) continue;
+      if (abs(candidates[c].y - features[f].y) >= searchHeightRadius) continue;
+      if ((best < 0) || (distances[c] < distances[best])) best = c;
+    }
+    if (best < 0) continue;
+    FeatureMatch match(features[f], distances[best]);
+    match.b = Feature(Pixel(candidates[best].x, candidates[best].y), candidates[best].x, candidates[best].y);
+    matches.push_back(match);
+  }
+}
+
+FeatureMatch R2Image::
+findFeatureMatchConsecutiveImages(const Feature& feature, const R2Pyramid& pyramid, const R2Pyramid& featurePyramid, const float searchAreaPercentage, const int ssdSearchRadius) {
+  const Point searchOrigin(feature.x, feature.y);
+  return findFeatureMatch(feature, pyramid, featurePyramid, searchOrigin, searchAreaPercentage, ssdSearchRadius);
+}
+
 // Takes in feature from originalImage, looks for it in this image with ssd
 FeatureMatch R2Image::
 findFeatureMatch(const Feature& feature, R2Image& featureImage, const Point searchOrigin, const float searchAreaPercentage, const int ssdSearchRadius) {
+  // Search this image's pyramid (built here, the search marks it) for the feature
+  // on featureImage's cached one
+  const R2Pyramid pyramid(View(), R2_FEATURE_MATCH_LEVELS);
+  const R2Pyramid& featurePyramid = (&featureImage == this) ? pyramid : featureImage.Pyramid(R2_FEATURE_MATCH_LEVELS);
+  return findFeatureMatch(feature, pyramid, featurePyramid, searchOrigin, searchAreaPercentage, ssdSearchRadius);
+}
+
+// Coarse to fine version of the exhaustive search below, both pyramids taken
+// before the search marks this image. The search area is the same, but only the
+// offsets refined down to level 0 are marked (the best coarse offsets when the
+// pyramids have a single level).
+FeatureMatch R2Image::
+findFeatureMatch(const Feature& feature, const R2Pyramid& pyramid, const R2Pyramid& featurePyramid, const Point searchOrigin, const float searchAreaPercentage, const int ssdSearchRadius) {
+    // Calculate search area, [xMin, xMax) by [yMin, yMax) in this image
+    const int searchWidthRadius = width * searchAreaPercentage / 2;
+    const int searchHeightRadius = height * searchAreaPercentage / 2;
+    const int xMin = fmax(0, searchOrigin.x - searchWidthRadius);
+    const int yMin = fmax(0, searchOrigin.y - searchHeightRadius);
+    const int xMax = fmin(width, searchOrigin.x + searchWidthRadius);
+    const int yMax = fmin(height, searchOrigin.y + searchHeightRadius);
+
+    // initialize match with highest possible SSD (luminance, at most 1 per pixel)
+    const int maxPossibleSSD = (2 * ssdSearchRadius + 1) * (2 * ssdSearchRadius + 1);
+    FeatureMatch match(feature, maxPossibleSSD);
+    if ((xMin >= xMax) || (yMin >= yMax)) return match;
+
+    // Window rows of the feature at every level in the order the bounded ssd should compare them
+    const int coarsest = std::min(pyramid.NLevels(), featurePyramid.NLevels()) - 1;
+    std::vector<std::vector<int> > rowOrders(coarsest + 1, std::vector<int>(2 * ssdSearchRadius + 1));
+    for (int level = 0; level <= coarsest; level++) {
+      featurePyramid.Level(level).calculateSSDRowOrder(feature.x >> level, feature.y >> level, ssdSearchRadius, rowOrders[level].data());
+    }
+    long candidates = 0, pruned = 0;
+
+    // Best few offsets over the whole search area at the coarsest level (sorted, best first)
+    const R2LuminanceImage& coarse = pyramid.Level(coarsest);
+    const R2LuminanceImage& featureCoarse = featurePyramid.Level(coarsest);
+    std::vector<std::pair<float, std::pair<int, int> > > best;
+    for (int x = xMin >> coarsest; x <= (xMax - 1) >> coarsest; x++) {
+      for (int y = yMin >> coarsest; y <= (yMax - 1) >> coarsest; y++) {
+        const float bound = (best.size() < R2_FEATURE_MATCH_COARSE_CANDIDATES) ? FLT_MAX : best.back().first;
+        const float ssd = coarse.calculateSSD(x, y, feature.x >> coarsest, feature.y >> coarsest, featureCoarse, ssdSearchRadius, rowOrders[coarsest].data(), bound);
+        candidates++;
+        if (ssd > bound) pruned++;
+        if (ssd >= bound) continue;
+        if (best.size() == R2_FEATURE_MATCH_COARSE_CANDIDATES) best.pop_back();
+        int k = best.size();
+        while ((k > 0) && (best[k - 1].first > ssd)) k--;
+        best.insert(best.begin() + k, std::make_pair(ssd, std::make_pair(x, y)));
+      }
+    }
+
+    // Each refined level by level within R2_FEATURE_MATCH_REFINE_RADIUS of twice the
+    // offset above, keeping the best at level 0
+    const int numBest = best.size();
+    for (int c = 0; c < numBest; c++) {
+      int xBest = best[c].second.first;
+      int yBest = best[c].second.second;
+      float ssdBest = best[c].first;
+      if (coarsest == 0) Pixel(xBest, yBest) = R2Pixel(0,1,0,1);
+      for (int level = coarsest - 1; level >= 0; level--) {
+        const R2LuminanceImage& luminance = pyramid.Level(level);
+        const R2LuminanceImage& featureLuminance = featurePyramid.Level(level);
+        const int xCenter = 2 * xBest;
+        const int yCenter = 2 * yBest;
+        ssdBest = FLT_MAX;
+        for (int x = std::max(xMin >> level, xCenter - R2_FEATURE_MATCH_REFINE_RADIUS); x <= std::min((xMax - 1) >> level, xCenter + R2_FEATURE_MATCH_REFINE_RADIUS); x++) {
+          for (int y = std::max(yMin >> level, yCenter - R2_FEATURE_MATCH_REFINE_RADIUS); y <= std::min((yMax - 1) >> level, yCenter + R2_FEATURE_MATCH_REFINE_RADIUS); y++) {
+            if (level == 0) Pixel(x, y) = R2Pixel(0,1,0,1);
+            const float ssd = luminance.calculateSSD(x, y, feature.x >> level, feature.y >> level, featureLuminance, ssdSearchRadius, rowOrders[level].data(), ssdBest);
+            candidates++;
+            if (ssd > ssdBest) pruned++;
+            if (ssd < ssdBest) {
+              ssdBest = ssd;
+              xBest = x;
+              yBest = y;
+            }
+          }
+        }
+      }
+      if (ssdBest < match.ssd) {
+        match.ssd = ssdBest;
+        match.b = Feature(Pixel(xBest, yBest), xBest, yBest);
+      }
+    }
+    SSD_CANDIDATES += candidates;
+    SSD_PRUNED += pruned;
+
+    // In verification mode the exhaustive search has the last word
+    if (FEATURE_MATCH_VERIFY) {
+      const FeatureMatch exhaustive = findFeatureMatch(feature, pyramid.Level(0), featurePyramid.Level(0), searchOrigin, searchAreaPercentage, ssdSearchRadius);
+      FEATURE_MATCHES_VERIFIED++;
+      if ((exhaustive.b.x != match.b.x) || (exhaustive.b.y != match.b.y)) FEATURE_MATCHES_DIFFERENT++;
+      return exhaustive;
+    }
+    return match;
+}
+
+// luminance is this image and featureLuminance the feature's image, both taken before the search marks this image
+FeatureMatch R2Image::
+findFeatureMatch(const Feature& feature, const R2LuminanceImage& luminance, const R2LuminanceImage& featureLuminance, const Point searchOrigin, const float searchAreaPercentage, const int ssdSearchRadius) {
     // Calculate search radii
     const int searchWidthRadius = width * searchAreaPercentage / 2;
     const int searchHeightRadius = height * searchAreaPercentage / 2;
 
-    // initialize match with highest possible SSD
-    const int maxPossibleSSD = (2 * ssdSearchRadius + 1) * (2 * ssdSearchRadius + 1) * 3;
+    // initialize match with highest possible SSD (luminance, at most 1 per pixel)
+    const int maxPossibleSSD = (2 * ssdSearchRadius + 1) * (2 * ssdSearchRadius + 1);
     FeatureMatch match(feature, maxPossibleSSD);
 
-    printf("Search Area: (%f, %f) -> (%f, %f) \n",fmax(0, searchOrigin.x - searchWidthRadius), fmax(0, searchOrigin.y - searchHeightRadius),
-    fmin(width, searchOrigin.x + searchWidthRadius), fmin(height, searchOrigin.y + searchHeightRadius));
-    
+    // Window rows of the feature in the order the bounded ssd should compare them
+    std::vector<int> rowOrder(2 * ssdSearchRadius + 1);
+    featureLuminance.calculateSSDRowOrder(feature.x, feature.y, ssdSearchRadius, rowOrder.data());
+    long candidates = 0, pruned = 0;
 
     // Search all pixels in search area to find most similar feature
     for (int x = fmax(0, searchOrigin.x - searchWidthRadius); x < fmin(width, searchOrigin.x + searchWidthRadius); x++) {
       for (int y = fmax(0, searchOrigin.y - searchHeightRadius); y < fmin(height, searchOrigin.y + searchHeightRadius); y++) {       
         //printf("Looking at pixel (%d, %d) \n", x, y);
         Pixel(x,y) = R2Pixel(0,1,0,1);
-        // calculate ssd for possible match, save it if it is the best yet
-        const float ssd = calculateSSD(x, y, feature.x, feature.y, featureImage, ssdSearchRadius);
+        // calculate ssd for possible match (up to the best so far), save it if it is the best yet
+        const float ssd = luminance.calculateSSD(x, y, feature.x, feature.y, featureLuminance, ssdSearchRadius, rowOrder.data(), match.ssd);
+        candidates++;
+        if (ssd > match.ssd) pruned++;
         if (ssd < match.ssd) {
            match.ssd = ssd;
            match.b = Feature(Pixel(x, y), x, y);
@@ -740,125 +1391,275 @@ findFeatureMatch(const Feature& feature, R2Image& featureImage, const Point sear
       }
     }
     Pixel(0, 0) = R2Pixel(0,1,0,1);
-    printf("SSD: %f\n", match.ssd);
+    SSD_CANDIDATES += candidates;
+    SSD_PRUNED += pruned;
     return match;
 }
 
-float R2Image::
-ssd(const R2Pixel& a, const R2Pixel& b) const {
-  const float rDif = a.Red() - b.Red();
-  const float gDif = a.Green() - b.Green();
-  const float bDif = a.Blue() - b.Blue();
-  return rDif * rDif + gDif * gDif + bDif * bDif;
+///////////////////////
+// Feature Finding
+//////////////////////
+void R2Image::
+findFeatures(double numFeatures, double minDistance, bool scaleInvariant, const R2Image& image, std::vector<Feature>& selectedFeatures) {
+  // Search the whole image
+  findFeatures(numFeatures, minDistance, scaleInvariant, image.View(), selectedFeatures);
+}
+
+// Selected features of one characteristic scale, bucketed by cell (cells are at
+// least the suppression radius across, so anything too close is in the 3x3 cells
+// around a feature)
+struct FeatureGrid {
+  double charScale;
+  double radius;
+  double cellSize;
+  int x0, y0;
+  int columns, rows;
+  std::vector<std::vector<int> > cells;
+};
+
+// Candidate for selection: its Harris response, characteristic scale and position
+// (a Feature is only assembled for the candidates selection gets to)
+struct FeatureCandidate {
+  float response;
+  float charScale;
+  int x, y;
+};
+
+static bool
+strongerCandidate(const FeatureCandidate& a, const FeatureCandidate& b) {
+  return a.response > b.response;
+}
+
+static Feature
+candidateFeature(const FeatureCandidate& candidate) {
+  // Harris pixels are gray, so the response gives back the whole pixel
+  const double response = candidate.response;
+  return Feature(R2Pixel(response, response, response, 1), candidate.x, candidate.y, candidate.charScale);
+}
+
+static void
+maximizeOverScales(std::vector<FeatureCandidate>& candidates, const R2ImageView& view) {
+  // Harris responses for sigma 2 to 18, each level blurred on from the previous one
+  R2HarrisScaleSpace scaleSpace(view, 2, 2, 9, SCALE_SPACE_OCTAVES);
+
+  // Keep the largest response of every candidate and the sigma it was found at
+  for (int level = 0; level < scaleSpace.NLevels(); level++) {
+    const float sigma = scaleSpace.Sigma(level);
+    for (size_t i = 0; i < candidates.size(); i++) {
+      FeatureCandidate& candidate = candidates[i];
+      const float response = scaleSpace.Response(level, candidate.x - view.X0(), candidate.y - view.Y0());
+      if (response > candidate.response) {
+        candidate.response = response;
+        candidate.charScale = sigma;
+      }
+    }
+  }
 }
 
-// x0 and y0 associated with this image, x1 and y1 associated with the passed in "otherImage"
-float R2Image::
-calculateSSD(const int x0, const int y0, const int x1, const int y1, R2Image& otherImage, const int ssdSearchRadius) {
-  float sum = 0;
-  for (int i = -ssdSearchRadius; i < ssdSearchRadius + 1; i++) {
-    for (int j = -ssdSearchRadius; j < ssdSearchRadius + 1; j++) {
+static FeatureGrid&
+scaleGrid(std::list<FeatureGrid>& grids, const R2ImageView& view, double minDistance, double charScale) {
+  // Grid of the features of this characteristic scale, started empty on first use
+  std::list<FeatureGrid>::iterator grid = grids.begin();
+  while ((grid != grids.end()) && (grid->charScale != charScale)) ++grid;
+  if (grid == grids.end()) {
+    grids.push_back(FeatureGrid());
+    grid = --grids.end();
+    grid->charScale = charScale;
+    grid->radius = minDistance * (charScale - 1);
+    grid->cellSize = std::max(grid->radius, (double) R2_FEATURE_GRID_MIN_CELL);
+    grid->x0 = view.X0();
+    grid->y0 = view.Y0();
+    grid->columns = (int) (view.Width() / grid->cellSize) + 1;
+    grid->rows = (int) (view.Height() / grid->cellSize) + 1;
+    grid->cells.resize(grid->columns * grid->rows);
+  }
+  return *grid;
+}
+
+static void
+bucketFeature(std::list<FeatureGrid>& grids, const R2ImageView& view, double minDistance, const std::vector<Feature>& selectedFeatures, int index) {
+  // Put a selected feature in the cell of its grid (features outside the view go
+  // in the nearest cell, which still has every close candidate around it)
+  const Feature& feature = selectedFeatures[index];
+  FeatureGrid& grid = scaleGrid(grids, view, minDistance, feature.charScale);
+  const int cx = std::min(grid.columns - 1, std::max(0, (int) ((feature.x - grid.x0) / grid.cellSize)));
+  const int cy = std::min(grid.rows - 1, std::max(0, (int) ((feature.y - grid.y0) / grid.cellSize)));
+  grid.cells[cy * grid.columns + cx].push_back(index);
+}
+
+static bool
+insertFeature(std::list<FeatureGrid>& grids, const R2ImageView& view, double minDistance, const Feature& feature, std::vector<Feature>& selectedFeatures) {
+  // Select feature unless an already selected one of the same characteristic scale
+  // is closer than minDistance * (scale - 1)
+  const FeatureGrid& grid = scaleGrid(grids, view, minDistance, feature.charScale);
+  const int cx = std::min(grid.columns - 1, std::max(0, (int) ((feature.x - grid.x0) / grid.cellSize)));
+  const int cy = std::min(grid.rows - 1, std::max(0, (int) ((feature.y - grid.y0) / grid.cellSize)));
+  for (int j = std::max(0, cy - 1); j <= std::min(grid.rows - 1, cy + 1); j++) {
+    for (int i = std::max(0, cx - 1); i <= std::min(grid.columns - 1, cx + 1); i++) {
+      const std::vector<int>& cell = grid.cells[j * grid.columns + i];
+      for (size_t k = 0; k < cell.size(); k++) {
+        if (feature.closeTo(selectedFeatures[cell[k]], grid.radius)) return false;
+      }
+    }
+  }
+  selectedFeatures.push_back(feature);
+  bucketFeature(grids, view, minDistance, selectedFeatures, selectedFeatures.size() - 1);
+  return true;
+}
 
-      if (inBounds(x0 + i, y0 + j) && otherImage.inBounds(x1 + i, y1 + j)) {
-          const R2Pixel& a = Pixel(x0 + i, y0 + j);
-          const R2Pixel& b = otherImage.Pixel(x1 + i, y1 + j);
-          
-          const float rDif = a.Red() - b.Red();
-          const float gDif = a.Green() - b.Green();
-          const float bDif = a.Blue() - b.Blue();
+static void
+orderCandidatesByIsolation(std::vector<FeatureCandidate>& candidates, const R2ImageView& view, int numFeatures) {
+  // Adaptive non-maximal suppression of candidates (given strongest first): every
+  // candidate's radius is the distance to the nearest one R2_FEATURE_ANMS_ROBUSTNESS
+  // stronger (responses measured from the 0.5 gray Harris leaves flat areas at),
+  // found by searching rings of grid cells outwards until they are further than the
+  // best so far. Candidates are left ordered by decreasing radius (strongest on ties).
+  const int n = candidates.size();
+  const double cellSize = std::max(1.0, sqrt((double) view.Width() * view.Height() / std::max(1, numFeatures)));
+  const int columns = (int) (view.Width() / cellSize) + 1;
+  const int rows = (int) (view.Height() / cellSize) + 1;
+  std::vector<std::vector<int> > cells(columns * rows);
+  std::vector<std::pair<double, int> > radii(n);
+  const double flat = 0.5;
+  int stronger = 0;
+  for (int f = 0; f < n; f++) {
+    // Features strong enough to suppress this one are in the grid
+    const double response = candidates[f].response - flat;
+    while ((stronger < f) && (R2_FEATURE_ANMS_ROBUSTNESS * (candidates[stronger].response - flat) > response)) {
+      const int cx = std::min(columns - 1, (int) ((candidates[stronger].x - view.X0()) / cellSize));
+      const int cy = std::min(rows - 1, (int) ((candidates[stronger].y - view.Y0()) / cellSize));
+      cells[cy * columns + cx].push_back(stronger);
+      stronger++;
+    }
 
-          sum += (rDif * rDif + gDif * gDif + bDif * bDif);
-        } else {
-          // account for out of bounds pixels by assigning them a difference of half maximum
-          sum += 3;
-        }    
+    const FeatureCandidate& candidate = candidates[f];
+    const int cx = std::min(columns - 1, (int) ((candidate.x - view.X0()) / cellSize));
+    const int cy = std::min(rows - 1, (int) ((candidate.y - view.Y0()) / cellSize));
+    double best = HUGE_VAL;
+    for (int ring = 0; ring <= std::max(columns, rows); ring++) {
+      const double nearest = (ring - 1) * cellSize;
+      if ((ring > 0) && (nearest * nearest >= best)) break;
+      for (int j = cy - ring; j <= cy + ring; j++) {
+        if ((j < 0) || (j >= rows)) continue;
+        const int step = ((j == cy - ring) || (j == cy + ring)) ? 1 : std::max(1, 2 * ring);
+        for (int i = cx - ring; i <= cx + ring; i += step) {
+          if ((i < 0) || (i >= columns)) continue;
+          const std::vector<int>& cell = cells[j * columns + i];
+          for (size_t k = 0; k < cell.size(); k++) {
+            const FeatureCandidate& other = candidates[cell[k]];
+            const double dx = other.x - candidate.x;
+            const double dy = other.y - candidate.y;
+            best = std::min(best, dx * dx + dy * dy);
+          }
+        }
+      }
     }
-  }   
-    return sum;
-}
+    radii[f] = std::make_pair(-best, f);
+  }
 
+  std::stable_sort(radii.begin(), radii.end());
+  std::vector<FeatureCandidate> ordered(n);
+  for (int f = 0; f < n; f++) ordered[f] = candidates[radii[f].second];
+  candidates.swap(ordered);
+}
 
-///////////////////////
-// Feature Finding
-//////////////////////
+// Only the pixels under the view are filtered; features come back in image coordinates
 void R2Image::
-findFeatures(double numFeatures, double minDistance, bool scaleInvariant, R2Image& image, std::vector<Feature>& selectedFeatures) {
-  std::vector<Feature> features;
+findFeatures(double numFeatures, double minDistance, bool scaleInvariant, const R2ImageView& view, std::vector<Feature>& selectedFeatures) {
+  std::vector<FeatureCandidate> candidates;
 
+  // Harris of the luminance plane (the response used to be taken per color and then reduced to luminance)
   const double sigma = 2.0;
-  R2Image harris(image);
-  harris.Harris(sigma, false);
-
-  // Grab all features above a certain luminance threshold (anything Harris identifies as as not a line or background)
-  for (int i = 0; i < image.Width(); i++) {
-    for (int j = 0; j < image.Height(); j++) {    
-      if (scaleInvariant || (harris.Pixel(i, j).Luminance() > 0.5)) {
-          features.push_back(Feature(harris.Pixel(i, j), i, j, sigma));
-      }     
+  R2LuminanceImage responses(view);
+  if (FEATURE_FAST && !scaleInvariant) {
+    // Or FAST corner scores, brought onto the scale of Harris: 0.5 where there is
+    // no corner, towards 1 for the strongest
+    responses.Blur(R2_FAST_DEFAULT_SIGMA, false);
+    R2PlanarImage scores(responses.Width(), responses.Height(), 1);
+    R2FastScorePlane(responses.Plane(0), responses.Width(), responses.Height(), responses.Stride(), R2_FAST_DEFAULT_ARC, R2_FAST_DEFAULT_THRESHOLD, scores.Plane(0));
+    for (int j = 0; j < responses.Height(); j++) {
+      for (int i = 0; i < responses.Width(); i++) {
+        responses.Value(0, i, j) = 0.5 + scores.Value(0, i, j) / (2 * R2_FAST_CIRCLE);
+      }
+    }
+  } else {
+    responses.Harris(sigma, false);
+  }
+
+  // Grab the local maxima of the response above a certain luminance threshold
+  // (anything Harris identifies as not a line or background, and not on the flank
+  // of a stronger corner). Scale invariant detection takes every pixel, their
+  // responses are replaced by the strongest over scales.
+  for (int i = 0; i < view.Width(); i++) {
+    for (int j = 0; j < view.Height(); j++) {
+      const float response = responses.Value(0, i, j);
+      FeatureCandidate candidate = { response, (float) sigma, view.X0() + i, view.Y0() + j };
+      if (scaleInvariant) {
+        candidates.push_back(candidate);
+        continue;
+      }
+      if (response <= 0.5) continue;
+      bool maximum = true;
+      for (int dj = -1; (dj <= 1) && maximum; dj++) {
+        for (int di = -1; di <= 1; di++) {
+          if (!responses.inBounds(i + di, j + dj)) continue;
+          if (responses.Value(0, i + di, j + dj) > response) maximum = false;
+        }
+      }
+      if (maximum) candidates.push_back(candidate);
     }
   }
-  // Finds characteristic scale for each point, sort them into feature scale groups (which are sorted from smallest to biggest)
-  if (scaleInvariant) {
-    findScaleInvariantHarrisFeaturePoints(features, image);
-  }
-
-  // Sort features from smallest to biggest
-  std::sort(features.begin(), features.end()); 
-  
-  const int numFeaturesWanted = fmin(numFeatures, features.size());
-
-  // Take most prominent features that are far enough apart
-  for (int i = features.size() - 1; i > 0 ; i--) {
-    bool shouldInsert = shouldInsertFeature(selectedFeatures, features[i], minDistance);
-    if (shouldInsert) {
-      selectedFeatures.push_back(features[i]);
-    } 
-
-    if (selectedFeatures.size() >= numFeaturesWanted) {
-      break;
+  // Finds characteristic scale for each point (features are then grouped by it)
+  if (scaleInvariant) maximizeOverScales(candidates, view);
+
+  // Only the strongest R2_FEATURE_ANMS_POOL * numFeatures are ranked by isolation
+  if (FEATURE_ANMS) {
+    const int pool = std::min((double) candidates.size(), R2_FEATURE_ANMS_POOL * numFeatures);
+    std::partial_sort(candidates.begin(), candidates.begin() + pool, candidates.end(), strongerCandidate);
+    candidates.resize(pool);
+    orderCandidatesByIsolation(candidates, view, numFeatures);
+  }
+
+  const int numFeaturesWanted = fmin(numFeatures, candidates.size());
+
+  // Take them strongest (or most isolated) first while they are far enough apart.
+  // Candidates are put in order R2_FEATURE_SELECTION_CHUNK * numFeatures at a time,
+  // each chunk partitioned off the rest before it is sorted.
+  const int chunk = std::max(1.0, R2_FEATURE_SELECTION_CHUNK * numFeatures);
+  const int numCandidates = candidates.size();
+  // Features selected before this call keep candidates away too.
+  int numSelected = selectedFeatures.size();
+  std::list<FeatureGrid> grids;
+  for (int k = 0; k < numSelected; k++) bucketFeature(grids, view, minDistance, selectedFeatures, k);
+  for (int begin = 0; (begin < numCandidates) && (numSelected < numFeaturesWanted); begin += chunk) {
+    const int end = std::min(numCandidates, begin + chunk);
+    if (!FEATURE_ANMS) {
+      if (end < numCandidates) std::nth_element(candidates.begin() + begin, candidates.begin() + end, candidates.end(), strongerCandidate);
+      std::sort(candidates.begin() + begin, candidates.begin() + end, strongerCandidate);
+    }
+    for (int i = begin; (i < end) && (numSelected < numFeaturesWanted); i++) {
+      if (insertFeature(grids, view, minDistance, candidateFeature(candidates[i]), selectedFeatures)) numSelected++;
     }
   }
 }
 
 
-bool R2Image::
-shouldInsertFeature(const std::vector<Feature>& features, const Feature& feature, const int minDistance) const {
-  // Features array should be sorted from largest to smallest
-
-  // Check to see if new feature smaller than any conflicting existing features
-  for (int i = 0; i < features.size(); i++) {
-    const Feature& existingFeature = features[i];
-
-    // if larger existing feature conflicts return
-    if ((feature.charScale == existingFeature.charScale) && feature.closeTo(existingFeature, minDistance * (feature.charScale - 1))) {
-      return false;
-    }
-  }
-  return true;
+void R2Image::
+findScaleInvariantHarrisFeaturePoints(std::vector<Feature>& features, const R2Image& image) {
+  findScaleInvariantHarrisFeaturePoints(features, image.View());
 }
 
 void R2Image::
-findScaleInvariantHarrisFeaturePoints(std::vector<Feature>& features, R2Image& image) {
-  const int size = features.size();
-
-  // loop over sigma values, keeping track of largest harris values and associated sigmas
-  for (int s = 1; s < 10; s++) {
-    const double sigma = 2 * s;
-    R2Image harris(image);
-    harris.Harris(sigma, false);
-
-    for (int i = 0; i < size; i++) {
-      Feature& f = features[i];
-      const R2Pixel& p = harris.Pixel(f.x, f.y);
-
-      const double newL = p.Luminance();
-      const double oldL = f.pixel.Luminance();
-
-      if (newL > oldL) {
-        f.pixel = p;
-        f.charScale = sigma;
-       }     
-    }
+findScaleInvariantHarrisFeaturePoints(std::vector<Feature>& features, const R2ImageView& view) {
+  // Features whose response is strongest at another scale take that response and scale
+  std::vector<FeatureCandidate> candidates(features.size());
+  for (size_t i = 0; i < features.size(); i++) {
+    FeatureCandidate candidate = { (float) features[i].pixel.Luminance(), (float) features[i].charScale, features[i].x, features[i].y };
+    candidates[i] = candidate;
+  }
+  maximizeOverScales(candidates, view);
+  for (size_t i = 0; i < features.size(); i++) {
+    if (candidates[i].response != (float) features[i].pixel.Luminance()) features[i] = candidateFeature(candidates[i]);
   }
 }
 
@@ -867,6 +1668,12 @@ findScaleInvariantHarrisFeaturePoints(std::vector<Feature>& features, R2Image& i
 //////////////////////
 void R2Image::
 classifyMatchesWithDltRANSAC(std::vector<FeatureMatch>& matches) const {
+  // A homography takes 4 matches, with fewer none of them can be verified
+  if (matches.size() < 4) {
+    for (size_t a = 0; a < matches.size(); a++) matches[a].verifiedMatch = false;
+    return;
+  }
+
   srand (time(NULL));
 
   std::vector<double> bestHomographyMatrix;
@@ -1152,7 +1959,7 @@ transformImage(const std::vector<double>& homographyMatrix) {
     }
   }
 
-  *this = transformedImage;
+  swap(transformedImage);
 }
 
 
@@ -1199,89 +2006,16 @@ SobelY(void)
 // Apply a 3x3 filter to an image
 void R2Image::
 applyFilter3x3( int filter[3][3]) {
-  R2Image tempImage(width, height);
-
-  for (int i = 1; i < width - 1; i++) {
-    for (int j = 1;  j < height - 1; j++) {
-      // Save effect of filter into temp image
-      R2Pixel tempPixel;
-      for (int a = 0; a < 3; a++) {
-        for (int b = 0; b < 3; b++) {
-          tempPixel += filter[a][b] * Pixel(i - 1 + a, j - 1 + b);
-        }
-      }
-      //tempPixel.Clamp();
-      tempImage.Pixel(i, j) = tempPixel;
-    }
-  }
-
-  // Copy changes back from temp image
-  for (int i = 1; i < width; i++) {
-    for (int j = 1;  j < height; j++) {
-      Pixel(i, j) = tempImage.Pixel(i, j);
-    }
-  }
-}
-
-// Calculates Gaussian distribution value
-double gaussianDistribution(double sigma, int x) {
-  double frac = 1.0 / (sqrt(2.0 * M_PI) * sigma);
-  double expo = exp(-(x * x) / (2.0 * sigma * sigma));
-  return frac * expo;
+  // Filter the whole image through a full view
+  View().applyFilter3x3(filter);
 }
 
 // Linear filtering ////////////////////////////////////////////////
 void R2Image::
 Blur(double sigma, bool clamped)
 {
-  R2Image tempImage(width, height);
-  const int kernelLength = 6 * sigma + 1;
-  const int kernelReach = 3 * sigma;
-
-  // Construct kernel
-  double gaussianKernel[kernelLength];
-  for (int i = 0; i < kernelLength; i++) {
-    gaussianKernel[i] = gaussianDistribution(sigma, i - kernelReach);
-  }
-
-  // Vertical pass
-  for (int i = 0; i < width; i++) {
-    for (int j = 0; j < height; j++) {
-      R2Pixel tempPixel;
-      double weightSum = 0;
-
-      const int lowerBound = fmax(-kernelReach, -j);
-      const int upperBound = fmin(kernelReach + 1, height - j);
-      for (int a = lowerBound; a < upperBound; a++) {
-        tempPixel += Pixel(i, j + a) * gaussianKernel[a + kernelReach];
-        weightSum += gaussianKernel[a + kernelReach];
-      }
-      tempPixel /= weightSum;
-      if (clamped) {
-        tempPixel.Clamp();
-      }
-      tempImage.Pixel(i, j) = tempPixel;
-    }
-  }
-
-  // Horizontal pass
-  for (int i = 0; i < width; i++) {
-    for (int j = 0; j < height; j++) {
-      R2Pixel tempPixel;
-      double weightSum = 0;
-      const int lowerBound = fmax(-kernelReach, -i);
-      const int upperBound = fmin(kernelReach + 1, width - i);
-      for (int a = lowerBound; a < upperBound; a++) {
-        tempPixel += tempImage.Pixel(i + a, j) * gaussianKernel[a + kernelReach];
-        weightSum += gaussianKernel[a + kernelReach];
-      }
-      tempPixel /= weightSum;
-      if (clamped) {
-        tempPixel.Clamp();
-      }
-      Pixel(i, j) = tempPixel;
-    }
-  }
+  // Blur the whole image through a full view
+  View().Blur(sigma, clamped);
 }
 
 ///////////////////////
@@ -1435,18 +2169,30 @@ R2Image(void)
   : pixels(NULL),
     npixels(0),
     width(0),
-    height(0)
+    height(0),
+    layout(R2_IMAGE_COLUMN_MAJOR_LAYOUT),
+    rowStride(0),
+    xstride(0),
+    ystride(1),
+    pyramid(NULL),
+    release(FreePixels)
 {
 }
 
 
 
 R2Image::
-R2Image(const char *filename)
+R2Image(const char *filename, R2ImageLayout layout)
   : pixels(NULL),
     npixels(0),
     width(0),
-    height(0)
+    height(0),
+    layout(layout),
+    rowStride(0),
+    xstride(0),
+    ystride(1),
+    pyramid(NULL),
+    release(FreePixels)
 {
   // Read image
   Read(filename);
@@ -1455,15 +2201,20 @@ R2Image(const char *filename)
 
 
 R2Image::
-R2Image(int width, int height)
+R2Image(int width, int height, R2ImageLayout layout, int rowStride)
   : pixels(NULL),
-    npixels(width * height),
-    width(width),
-    height(height)
+    npixels(0),
+    width(0),
+    height(0),
+    layout(layout),
+    rowStride(rowStride),
+    xstride(0),
+    ystride(1),
+    pyramid(NULL),
+    release(FreePixels)
 {
   // Allocate pixels
-  pixels = new R2Pixel [ npixels ];
-  assert(pixels);
+  Resize(width, height);
 }
 
 
@@ -1471,45 +2222,103 @@ R2Image(int width, int height)
 R2Image::
 R2Image(int width, int height, const R2Pixel *p)
   : pixels(NULL),
-    npixels(width * height),
-    width(width),
-    height(height)
+    npixels(0),
+    width(0),
+    height(0),
+    layout(R2_IMAGE_COLUMN_MAJOR_LAYOUT),
+    rowStride(0),
+    xstride(0),
+    ystride(1),
+    pyramid(NULL),
+    release(FreePixels)
 {
   // Allocate pixels
-  pixels = new R2Pixel [ npixels ];
-  assert(pixels);
+  Resize(width, height);
 
-  // Copy pixels
+  // Copy pixels (given in column-major order)
   for (int i = 0; i < npixels; i++)
     pixels[i] = p[i];
 }
 
 
 
+R2Image::
+R2Image(R2Pixel *adoptedPixels, int width, int height, R2ImagePixelRelease release, R2ImageLayout layout, int rowStride)
+  : pixels(adoptedPixels),
+    npixels(width * height),
+    width(width),
+    height(height),
+    layout(layout),
+    rowStride(0),
+    xstride(height),
+    ystride(1),
+    pyramid(NULL),
+    release(release)
+{
+  // Take ownership of pixels (no copy is made), to be given back with release
+  // Row-major buffers must hold rowStride * height pixels
+  if (layout == R2_IMAGE_ROW_MAJOR_LAYOUT) {
+    this->rowStride = (rowStride < width) ? width : rowStride;
+    xstride = 1;
+    ystride = this->rowStride;
+  }
+}
+
+
+
 R2Image::
 R2Image(const R2Image& image)
   : pixels(NULL),
-    npixels(image.npixels),
-    width(image.width),
-    height(image.height)
-
+    npixels(0),
+    width(0),
+    height(0),
+    layout(image.layout),
+    rowStride(image.rowStride),
+    xstride(0),
+    ystride(1),
+    pyramid(NULL),
+    release(FreePixels)
 {
   // Allocate pixels
-  pixels = new R2Pixel [ npixels ];
-  assert(pixels);
+  Resize(image.width, image.height);
 
-  // Copy pixels
-  for (int i = 0; i < npixels; i++)
+  // Copy pixels (padding included)
+  const int n = BufferSize();
+  for (int i = 0; i < n; i++)
     pixels[i] = image.pixels[i];
 }
 
 
 
+R2Image::
+R2Image(R2Image&& image) noexcept
+  : pixels(image.pixels),
+    npixels(image.npixels),
+    width(image.width),
+    height(image.height),
+    layout(image.layout),
+    rowStride(image.rowStride),
+    xstride(image.xstride),
+    ystride(image.ystride),
+    pyramid(image.pyramid),
+    release(image.release)
+{
+  // Steal pixels (and their pyramid), leave image empty
+  image.pixels = NULL;
+  image.release = FreePixels;
+  image.pyramid = NULL;
+  image.npixels = image.width = image.height = 0;
+  image.rowStride = image.xstride = 0;
+}
+
+
+
 R2Image::
 ~R2Image(void)
 {
   // Free image pixels
-  if (pixels) delete [] pixels;
+  ReleasePixels();
+  delete pyramid;
 }
 
 
@@ -1517,20 +2326,20 @@ R2Image::
 R2Image& R2Image::
 operator=(const R2Image& image)
 {
-  // Delete previous pixels
-  if (pixels) { delete [] pixels; pixels = NULL; }
+  // Check for self assignment
+  if (this == &image) return *this;
 
-  // Reset width and height
-  npixels = image.npixels;
-  width = image.width;
-  height = image.height;
+  // Delete previous pixels
+  ReleasePixels();
 
-  // Allocate new pixels
-  pixels = new R2Pixel [ npixels ];
-  assert(pixels);
+  // Reset layout, width and height, and allocate new pixels
+  layout = image.layout;
+  rowStride = image.rowStride;
+  Resize(image.width, image.height);
 
-  // Copy pixels
-  for (int i = 0; i < npixels; i++)
+  // Copy pixels (padding included)
+  const int n = BufferSize();
+  for (int i = 0; i < n; i++)
     pixels[i] = image.pixels[i];
 
   // Return image
@@ -1538,6 +2347,214 @@ operator=(const R2Image& image)
 }
 
 
+
+R2Image& R2Image::
+operator=(R2Image&& image) noexcept
+{
+  // Take over pixels, the old ones go away with image
+  swap(image);
+
+  // Return image
+  return *this;
+}
+
+
+
+void R2Image::
+swap(R2Image& image) noexcept
+{
+  // Exchange pixels and shape without copying
+  std::swap(pixels, image.pixels);
+  std::swap(npixels, image.npixels);
+  std::swap(width, image.width);
+  std::swap(height, image.height);
+  std::swap(layout, image.layout);
+  std::swap(rowStride, image.rowStride);
+  std::swap(xstride, image.xstride);
+  std::swap(ystride, image.ystride);
+  std::swap(pyramid, image.pyramid);
+  std::swap(release, image.release);
+}
+
+
+
+int R2Image::
+BufferSize(void) const
+{
+  // Return number of allocated pixels (row-major rows may be padded)
+  return (layout == R2_IMAGE_ROW_MAJOR_LAYOUT) ? rowStride * height : npixels;
+}
+
+
+
+void R2Image::
+Resize(int w, int h)
+{
+  // Free previous pixels (and anything derived from them)
+  ReleasePixels();
+  InvalidatePyramid();
+
+  // Reset width, height and strides for the current layout
+  width = w;
+  height = h;
+  npixels = width * height;
+  if (layout == R2_IMAGE_ROW_MAJOR_LAYOUT) {
+    // Rows padded to rowStride, or to R2_IMAGE_ROW_ALIGNMENT pixels by default
+    if (rowStride < width) {
+      rowStride = ((width + R2_IMAGE_ROW_ALIGNMENT - 1) / R2_IMAGE_ROW_ALIGNMENT) * R2_IMAGE_ROW_ALIGNMENT;
+    }
+    xstride = 1;
+    ystride = rowStride;
+  }
+  else {
+    rowStride = 0;
+    xstride = height;
+    ystride = 1;
+  }
+
+  // Allocate pixels
+  const int n = BufferSize();
+  if (n > 0) {
+    pixels = AllocatePixels(n);
+    assert(pixels);
+  }
+}
+
+
+
+R2Pixel *R2Image::
+AllocatePixels(int n)
+{
+  // Draw a buffer of n zeroed pixels from the calling thread's pool
+  if (n <= 0) return NULL;
+  R2Pixel *p = (R2Pixel *) R2BufferPool::ThreadPool().Allocate(n * sizeof(R2Pixel));
+  for (int i = 0; i < n; i++) {
+    new (&p[i]) R2Pixel();
+  }
+  return p;
+}
+
+
+
+void R2Image::
+FreePixels(R2Pixel *p, int n)
+{
+  // Return a buffer from AllocatePixels to the calling thread's pool
+  if (!p) return;
+  R2BufferPool::ThreadPool().Release(p, n * sizeof(R2Pixel));
+}
+
+
+
+void R2Image::
+DeletePixels(R2Pixel *p, int n)
+{
+  // Delete a buffer allocated with new R2Pixel[]
+  delete [] p;
+}
+
+
+
+void R2Image::
+ReleasePixels(void)
+{
+  // Give pixels back the way they were allocated (later buffers come from the pool)
+  if (pixels) release(pixels, BufferSize());
+  pixels = NULL;
+  release = FreePixels;
+}
+
+
+
+void R2Image::
+SetLayout(R2ImageLayout newLayout, int newRowStride)
+{
+  // Nothing to do if layout already matches
+  if ((newLayout == layout) && ((newLayout == R2_IMAGE_COLUMN_MAJOR_LAYOUT) || (newRowStride <= 0) || (newRowStride == rowStride))) return;
+
+  // Reallocate in the new layout and copy pixels over
+  R2Image reordered(width, height, newLayout, newRowStride);
+  if (newLayout == R2_IMAGE_ROW_MAJOR_LAYOUT) {
+    for (int j = 0; j < height; j++) {
+      for (int i = 0; i < width; i++) {
+        reordered.Pixel(i, j) = Pixel(i, j);
+      }
+    }
+  }
+  else {
+    for (int i = 0; i < width; i++) {
+      for (int j = 0; j < height; j++) {
+        reordered.Pixel(i, j) = Pixel(i, j);
+      }
+    }
+  }
+  swap(reordered);
+}
+
+
+
+R2ImageView R2Image::
+View(void)
+{
+  // View of the whole image (writable, so the pyramid is dropped)
+  if (pyramid) InvalidatePyramid();
+  return R2ImageView(pixels, width, height, xstride, ystride);
+}
+
+
+
+R2ImageView R2Image::
+View(int x0, int y0, int w, int h)
+{
+  // View of a rectangle of the image (clipped to the image)
+  return View().View(x0, y0, w, h);
+}
+
+
+
+R2ImageView R2Image::
+View(void) const
+{
+  // View of the whole image for reading (the pyramid is kept)
+  return R2ImageView(pixels, width, height, xstride, ystride);
+}
+
+
+
+R2ImageView R2Image::
+View(int x0, int y0, int w, int h) const
+{
+  // View of a rectangle of the image for reading (clipped to the image)
+  return View().View(x0, y0, w, h);
+}
+
+
+
+const R2Pyramid& R2Image::
+Pyramid(int nlevels) const
+{
+  // Build pyramid on first use, and extend it if more levels are asked for
+  if (!pyramid) {
+    pyramid = new R2Pyramid(View(), nlevels);
+  }
+  else if (pyramid->NLevels() < nlevels) {
+    pyramid->Extend(nlevels);
+  }
+  return *pyramid;
+}
+
+
+
+void R2Image::
+InvalidatePyramid(void)
+{
+  // Drop pyramid, the next Pyramid() call rebuilds it
+  delete pyramid;
+  pyramid = NULL;
+}
+
+
+
 void R2Image::
 svdTest(void)
 {
@@ -1705,42 +2722,9 @@ HighPass(double sigma, double contrast) {
 void R2Image::
 Harris(double sigma, bool clamped)
 {
-  // Harris corner detector. Make use of the previously developed filters, such as the Gaussian blur filter
+  // Harris corner detector on the whole image through a full view
 	// Output should be 50% grey at flat regions, white at corners and black/dark near edges
-
-  R2Image xSquared(*this);
-  R2Image ySquared(*this);
-
-  // Why can't I initialize this image with just width and height? get segfault
-  R2Image xy(*this);
-
-  xSquared.SobelX();
-  ySquared.SobelY();
-
-  // Fill images with correct values;
-  for (int i = 0; i < width; i++) {
-    for (int j = 0; j < height; j++) {
-      // For now xSquared and ySquared just contain x and y at (i, j)
-      xy.Pixel(i, j) = xSquared.Pixel(i, j) * ySquared.Pixel(i, j);
-      xSquared.Pixel(i, j) *= xSquared.Pixel(i, j);
-      ySquared.Pixel(i, j) *= ySquared.Pixel(i, j);
-    }
-  }
-
-  xSquared.Blur(sigma, false);
-  ySquared.Blur(sigma, false);
-  xy.Blur(sigma,false);
-
-  for(int i = 0; i < width; i++) {
-    for(int j = 0; j < height; j++) {
-      Pixel(i, j) = (xSquared.Pixel(i, j) * ySquared.Pixel(i, j)) - (xy.Pixel(i, j) * xy.Pixel(i, j)) - 0.04 * ((xSquared.Pixel(i, j) + ySquared.Pixel(i, j)) * (xSquared.Pixel(i, j) + ySquared.Pixel(i, j)));
-      R2Pixel shift(0.5, 0.5, 0.5, 1);
-      Pixel(i, j) += shift;
-      if (clamped) {
-        Pixel(i, j).Clamp();
-      }    
-    }
-  }
+  View().Harris(sigma, clamped);
 }
 
 bool R2Image::
@@ -1847,9 +2831,10 @@ blendOtherImageHomography(R2Image * otherImage)
 int R2Image::
 Read(const char *filename)
 {
-  // Initialize everything
-  if (pixels) { delete [] pixels; pixels = NULL; }
+  // Initialize everything (layout is kept)
+  ReleasePixels();
   npixels = width = height = 0;
+  InvalidatePyramid();
 
   // Parse input filename extension
   char *input_extension;
@@ -2063,13 +3048,8 @@ ReadBMP(const char *filename)
   if ((lineLength % 4) != 0) lineLength = (lineLength / 4 + 1) * 4;
   assert(bmih.biSizeImage == (unsigned int) lineLength * (unsigned int) bmih.biHeight);
 
-  // Assign width, height, and number of pixels
-  width = bmih.biWidth;
-  height = bmih.biHeight;
-  npixels = width * height;
-
   // Allocate unsigned char buffer for reading pixels
-  int rowsize = 3 * width;
+  int rowsize = 3 * bmih.biWidth;
   if ((rowsize % 4) != 0) rowsize = (rowsize / 4 + 1) * 4;
   int nbytes = bmih.biSizeImage;
   unsigned char *buffer = new unsigned char [nbytes];
@@ -2090,10 +3070,9 @@ ReadBMP(const char *filename)
   fclose(fp);
 
   // Allocate pixels for image
-  pixels = new R2Pixel [ width * height ];
+  Resize(bmih.biWidth, bmih.biHeight);
   if (!pixels) {
     fprintf(stderr, "Unable to allocate memory for BMP file");
-    fclose(fp);
     return 0;
   }
 
@@ -2174,7 +3153,7 @@ WriteBMP(const char *filename) const
   int pad = rowsize - width * 3;
   for (int j = 0; j < height; j++) {
     for (int i = 0; i < width; i++) {
-      const R2Pixel& pixel = (*this)[i][j];
+      const R2Pixel& pixel = Pixel(i, j);
       double r = 255.0 * pixel.Red();
       double g = 255.0 * pixel.Green();
       double b = 255.0 * pixel.Blue();
@@ -2229,7 +3208,8 @@ ReadPPM(const char *filename)
   ungetc(c, fp);
 
   // Read width and height
-  if (fscanf(fp, "%d%d", &width, &height) != 2) {
+  int w, h;
+  if (fscanf(fp, "%d%d", &w, &h) != 2) {
     fprintf(stderr, "Unable to read width and height in PPM file");
     fclose(fp);
     return 0;
@@ -2244,7 +3224,7 @@ ReadPPM(const char *filename)
   }
 
   // Allocate image pixels
-  pixels = new R2Pixel [ width * height ];
+  Resize(w, h);
   if (!pixels) {
     fprintf(stderr, "Unable to allocate memory for PPM file");
     fclose(fp);
@@ -2320,7 +3300,7 @@ WritePPM(const char *filename, int ascii) const
     fprintf(fp, "255\n");
     for (int j = height-1; j >= 0 ; j--) {
       for (int i = 0; i < width; i++) {
-        const R2Pixel& p = (*this)[i][j];
+        const R2Pixel& p = Pixel(i, j);
         int r = (int) (255 * p.Red());
         int g = (int) (255 * p.Green());
         int b = (int) (255 * p.Blue());
@@ -2349,7 +3329,7 @@ WritePPM(const char *filename, int ascii) const
     fprintf(fp, "255\n");
     for (int j = height-1; j >= 0 ; j--) {
       for (int i = 0; i < width; i++) {
-        const R2Pixel& p = (*this)[i][j];
+        const R2Pixel& p = Pixel(i, j);
         int r = (int) (255 * p.Red());
         int g = (int) (255 * p.Green());
         int b = (int) (255 * p.Blue());
@@ -2423,60 +3403,35 @@ ReadJPEG(const char *filename)
   jpeg_read_header(&cinfo, TRUE);
   jpeg_start_decompress(&cinfo);
 
-  // Remember image attributes
-  width = cinfo.output_width;
-  height = cinfo.output_height;
-  npixels = width * height;
-  int ncomponents = cinfo.output_components;
-
   // Allocate pixels for image
-  pixels = new R2Pixel [ npixels ];
+  int ncomponents = cinfo.output_components;
+  Resize(cinfo.output_width, cinfo.output_height);
   if (!pixels) {
-    fprintf(stderr, "Unable to allocate memory for BMP file");
+    fprintf(stderr, "Unable to allocate memory for JPEG file");
     fclose(fp);
     return 0;
   }
 
-  // Allocate unsigned char buffer for reading image
-  int rowsize = ncomponents * width;
-  if ((rowsize % 4) != 0) rowsize = (rowsize / 4 + 1) * 4;
-  int nbytes = rowsize * height;
-  unsigned char *buffer = new unsigned char [nbytes];
+  // Allocate unsigned char buffer for one scan line
+  unsigned char *buffer = new unsigned char [ncomponents * width];
   if (!buffer) {
     fprintf(stderr, "Unable to allocate temporary memory for JPEG file");
     fclose(fp);
     return 0;
   }
 
-  // Read scan lines
+  // Read scan lines, converting each one straight into its pixel row
   // First jpeg pixel is top-left, so read pixels in opposite scan-line order
   while (cinfo.output_scanline < cinfo.output_height) {
-    int scanline = cinfo.output_height - cinfo.output_scanline - 1;
-    unsigned char *row_pointer = &buffer[scanline * rowsize];
-    jpeg_read_scanlines(&cinfo, &row_pointer, 1);
-  }
-
-  // Free everything
-  jpeg_finish_decompress(&cinfo);
-  jpeg_destroy_decompress(&cinfo);
-
-  // Close file
-  fclose(fp);
-
-  // Assign pixels
-  for (int j = 0; j < height; j++) {
-    unsigned char *p = &buffer[j * rowsize];
+    int j = cinfo.output_height - cinfo.output_scanline - 1;
+    unsigned char *p = buffer;
+    jpeg_read_scanlines(&cinfo, &p, 1);
     for (int i = 0; i < width; i++) {
       double r, g, b, a;
       if (ncomponents == 1) {
         r = g = b = (double) *(p++) / 255;
         a = 1;
       }
-      else if (ncomponents == 1) {
-        r = g = b = (double) *(p++) / 255;
-        a = 1;
-        p++;
-      }
       else if (ncomponents == 3) {
         r = (double) *(p++) / 255;
         g = (double) *(p++) / 255;
@@ -2491,13 +3446,22 @@ ReadJPEG(const char *filename)
       }
       else {
         fprintf(stderr, "Unrecognized number of components in jpeg image: %d\n", ncomponents);
+        delete [] buffer;
+        jpeg_destroy_decompress(&cinfo);
+        fclose(fp);
         return 0;
       }
-      R2Pixel pixel(r, g, b, a);
-      SetPixel(i, j, pixel);
+      Pixel(i, j).Reset(r, g, b, a);
     }
   }
 
+  // Free everything
+  jpeg_finish_decompress(&cinfo);
+  jpeg_destroy_decompress(&cinfo);
+
+  // Close file
+  fclose(fp);
+
   // Free unsigned char buffer for reading pixels
   delete [] buffer;
 
@@ -2539,22 +3503,21 @@ WriteJPEG(const char *filename) const
   jpeg_set_quality(&cinfo, 95, TRUE);
   jpeg_start_compress(&cinfo, TRUE);
 
-  // Allocate unsigned char buffer for reading image
-  int rowsize = 3 * width;
-  if ((rowsize % 4) != 0) rowsize = (rowsize / 4 + 1) * 4;
-  int nbytes = rowsize * height;
-  unsigned char *buffer = new unsigned char [nbytes];
+  // Allocate unsigned char buffer for one scan line
+  unsigned char *buffer = new unsigned char [3 * width];
   if (!buffer) {
     fprintf(stderr, "Unable to allocate temporary memory for JPEG file");
     fclose(fp);
     return 0;
   }
 
-  // Fill buffer with pixels
-  for (int j = 0; j < height; j++) {
-    unsigned char *p = &buffer[j * rowsize];
+  // Convert and output scan lines one pixel row at a time
+  // First jpeg pixel is top-left, so write in opposite scan-line order
+  while (cinfo.next_scanline < cinfo.image_height) {
+    int j = cinfo.image_height - cinfo.next_scanline - 1;
+    unsigned char *p = buffer;
     for (int i = 0; i < width; i++) {
-      const R2Pixel& pixel = (*this)[i][j];
+      const R2Pixel& pixel = Pixel(i, j);
       int r = (int) (255 * pixel.Red());
       int g = (int) (255 * pixel.Green());
       int b = (int) (255 * pixel.Blue());
@@ -2565,15 +3528,7 @@ WriteJPEG(const char *filename) const
       *(p++) = g;
       *(p++) = b;
     }
-  }
-
-
-
-  // Output scan lines
-  // First jpeg pixel is top-left, so write in opposite scan-line order
-  while (cinfo.next_scanline < cinfo.image_height) {
-    int scanline = cinfo.image_height - cinfo.next_scanline - 1;
-    unsigned char *row_pointer = &buffer[scanline * rowsize];
+    unsigned char *row_pointer = buffer;
     jpeg_write_scanlines(&cinfo, &row_pointer, 1);
   }
 
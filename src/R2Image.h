@@ -21,6 +21,82 @@ typedef enum {
   R2_IMAGE_NUM_SAMPLING_METHODS
 } R2ImageSamplingMethod;
 
+typedef enum {
+  R2_IMAGE_COLUMN_MAJOR_LAYOUT,
+  R2_IMAGE_ROW_MAJOR_LAYOUT,
+  R2_IMAGE_NUM_LAYOUTS
+} R2ImageLayout;
+
+// Releases a pixel buffer of n pixels an image has adopted
+class R2Pixel;
+typedef void (*R2ImagePixelRelease)(R2Pixel *pixels, int n);
+
+// Default row padding for row-major images (in pixels, 2 R2Pixels = one 64-byte cache line)
+#define R2_IMAGE_ROW_ALIGNMENT 2
+
+// Coarse-to-fine marker search: markers are matched exhaustively at the coarsest
+// pyramid level where they are still R2_MARKER_SEARCH_MIN_SIZE pixels across, and
+// the best R2_MARKER_SEARCH_CANDIDATES matches are refined within
+// R2_MARKER_SEARCH_RADIUS pixels at every finer level
+#define R2_MARKER_SEARCH_MIN_SIZE 8
+#define R2_MARKER_SEARCH_CANDIDATES 5
+#define R2_MARKER_SEARCH_RADIUS 2
+
+// The exhaustive level switches to FFT correlation once direct SSDs (positions times
+// marker pixels) cost more than this many times N log N of the transform size N
+#define R2_MARKER_SEARCH_FFT_RATIO 20
+
+// Direct exhaustive searches are split into bands of at least this many rows that
+// run as separate tasks (on the worker pool in multi thread mode)
+#define R2_MARKER_SEARCH_TILE_ROWS 32
+
+// Marker motion model: tracked markers are searched R2_MARKER_TRACK_ERROR_GAIN times
+// their recent prediction error (at least R2_MARKER_TRACK_MIN_REACH pixels, at most
+// the untracked window) around where their velocity puts them. A match on the
+// edge of its box, or with an ssd over R2_MARKER_TRACK_SSD_GROWTH times the usual
+// one, is searched again with twice the reach. R2_MARKER_TRACK_ALPHA/BETA are the
+// filter gains for position and velocity, R2_MARKER_TRACK_DECAY the weight of the
+// newest error and ssd.
+#define R2_MARKER_TRACK_ERROR_GAIN 3.0
+#define R2_MARKER_TRACK_MIN_REACH 3
+#define R2_MARKER_TRACK_SSD_GROWTH 1.5
+#define R2_MARKER_TRACK_ALPHA 0.85
+#define R2_MARKER_TRACK_BETA 0.5
+#define R2_MARKER_TRACK_DECAY 0.5
+
+// Lucas-Kanade fast path: tracked markers are first followed from their predicted
+// position, and only searched when that ends more than R2_MARKER_TRACK_LK_STEPS
+// pixels from an ssd minimum or matches worse than R2_MARKER_TRACK_SSD_GROWTH allows.
+// A marker it lost is searched for the next R2_MARKER_TRACK_LK_WAIT frames.
+#define R2_MARKER_TRACK_LK_STEPS 2
+#define R2_MARKER_TRACK_LK_WAIT 4
+
+// Feature selection: selected features are kept in a grid of cells at least as
+// wide as the minDistance radius (and at least R2_FEATURE_GRID_MIN_CELL pixels),
+// so a candidate is only checked against the 3x3 cells around it. With ANMS on,
+// the R2_FEATURE_ANMS_POOL times as many strongest candidates as features wanted
+// are ranked by their radius: the distance to the nearest one whose response,
+// times R2_FEATURE_ANMS_ROBUSTNESS, is still stronger (weaker candidates would win
+// by being alone in flat areas). Candidates are otherwise only ordered
+// R2_FEATURE_SELECTION_CHUNK times as many as features wanted at a time.
+#define R2_FEATURE_GRID_MIN_CELL 16
+#define R2_FEATURE_ANMS_POOL 10
+#define R2_FEATURE_ANMS_ROBUSTNESS 0.9
+#define R2_FEATURE_SELECTION_CHUNK 2
+
+// Descriptor matching: features of the original image are matched to the
+// R2_FEATURE_BRIEF_CANDIDATES times as many features of this one, each to the
+// nearest in Hamming distance inside the search area
+#define R2_FEATURE_BRIEF_CANDIDATES 2
+
+// Feature match search: the whole search area is only searched at pyramid level
+// R2_FEATURE_MATCH_LEVELS - 1, and the R2_FEATURE_MATCH_COARSE_CANDIDATES best
+// offsets there are each refined within R2_FEATURE_MATCH_REFINE_RADIUS pixels at
+// every finer level (so a repeated pattern is not decided on the coarse level)
+#define R2_FEATURE_MATCH_LEVELS 4
+#define R2_FEATURE_MATCH_COARSE_CANDIDATES 3
+#define R2_FEATURE_MATCH_REFINE_RADIUS 2
+
 typedef enum {
   R2_IMAGE_OVER_COMPOSITION,
   R2_IMAGE_IN_COMPOSITION,
@@ -61,6 +137,21 @@ struct Point {
   }
 };
 
+// Motion of one marker from frame to frame: alpha-beta filtered position and
+// velocity (pixels per frame), recent prediction error per axis, the usual ssd of
+// its matches, and how many frames to search before trying Lucas-Kanade again
+// (tracks start out empty and are filled by findMarkers)
+struct MarkerTrack {
+  Point position;
+  Point velocity;
+  Point error;
+  float ssd;
+  int nframes;
+  int searchFrames;
+
+  MarkerTrack() : position(-1, -1), velocity(0, 0), error(0, 0), ssd(0), nframes(0), searchFrames(0) {}
+};
+
 struct PointMatch {
   Point& a;
   Point& b;
@@ -149,31 +240,68 @@ struct FeatureMatch {
 
 #include <vector>
 
+class R2ImageView;
+class R2PlanarImage;
+class R2LuminanceImage;
+class R2Pyramid;
+
 class R2Image {
  public:
   // Constructors/destructor
   R2Image(void);
-  R2Image(const char *filename);
-  R2Image(int width, int height);
+  R2Image(const char *filename, R2ImageLayout layout = R2_IMAGE_COLUMN_MAJOR_LAYOUT);
+  R2Image(int width, int height, R2ImageLayout layout = R2_IMAGE_COLUMN_MAJOR_LAYOUT, int rowStride = 0);
   R2Image(int width, int height, const R2Pixel *pixels);
+  R2Image(R2Pixel *adoptedPixels, int width, int height, R2ImagePixelRelease release, R2ImageLayout layout = R2_IMAGE_COLUMN_MAJOR_LAYOUT, int rowStride = 0);
   R2Image(const R2Image& image);
+  R2Image(R2Image&& image) noexcept;
   ~R2Image(void);
 
   // Image properties
   int NPixels(void) const;
   int Width(void) const;
   int Height(void) const;
+  R2ImageLayout Layout(void) const;
+  int RowStride(void) const;
+
+  // Memory layout (row-major rows are RowStride() pixels apart, padding included)
+  void SetLayout(R2ImageLayout layout, int rowStride = 0);
 
   // Pixel access/update
   R2Pixel& Pixel(int x, int y);
+  const R2Pixel& Pixel(int x, int y) const;
   R2Pixel *Pixels(void);
-  R2Pixel *Pixels(int row);
-  R2Pixel *operator[](int row);
-  const R2Pixel *operator[](int row) const;
+  R2Pixel *Pixels(int x);
+  R2Pixel *operator[](int x);
+  const R2Pixel *operator[](int x) const;
   void SetPixel(int x, int y,  const R2Pixel& pixel);
 
+  // Pixel buffers (drawn from the calling thread's R2BufferPool, n is the buffer size in pixels).
+  // An adopted buffer is given back with the release it was adopted with, which the
+  // caller must name: FreePixels for AllocatePixels buffers, DeletePixels for
+  // new R2Pixel[] ones.
+  static R2Pixel *AllocatePixels(int n);
+  static void FreePixels(R2Pixel *pixels, int n);
+  static void DeletePixels(R2Pixel *pixels, int n);
+
+  // Zero-copy views (clipped to the image, share its pixels). Views of a const
+  // image are for reading only, they keep the pyramid.
+  R2ImageView View(void);
+  R2ImageView View(int x0, int y0, int width, int height);
+  R2ImageView View(void) const;
+  R2ImageView View(int x0, int y0, int width, int height) const;
+
+  // Gaussian pyramid of luminance, built on first use and kept until the pixels
+  // change. Non-const pixel access, writable views and the operations writing the
+  // pixels drop it; anything written through pointers or views taken earlier must
+  // call InvalidatePyramid() itself.
+  const R2Pyramid& Pyramid(int nlevels) const;
+  void InvalidatePyramid(void);
+
   // Image processing
   R2Image& operator=(const R2Image& image);
+  R2Image& operator=(R2Image&& image) noexcept;
+  void swap(R2Image& image) noexcept;
 
   // Per-pixel operations
   void Brighten(double factor);
@@ -182,30 +310,32 @@ class R2Image {
   // show how SVD works
   void svdTest();
 
-  struct Marker {
-    R2Image* frame;
-    R2Image* marker;
-    Point* markerLocation; 
-    Point* oldMarkerLocation;
-    std::vector<Point*>* markerLocs;
-    int index;
-
-    Marker(R2Image* f, R2Image* m, Point* l, Point* o, std::vector<Point*>* locs, int i)
-    :frame(f), marker(m), markerLocation(l), oldMarkerLocation(o), markerLocs(locs), index(i) {}
-  };
-
 
   // Freeze Frame
   void identifyCorners(std::vector<R2Image>& markerImages, std::vector<Point>& oldMarkerLocations);
+  void identifyCorners(std::vector<R2Image>& markerImages, std::vector<Point>& oldMarkerLocations, std::vector<MarkerTrack>& tracks);
   void placeImageInFrame(std::vector<Point>& markerLocations, R2Image& otherImage);
   void findMarkers(std::vector<R2Image>& markers, std::vector<Point>& markerLocations, std::vector<Point>& oldMarkerLocations);
+  void findMarkers(std::vector<R2Image>& markers, std::vector<Point>& markerLocations, std::vector<MarkerTrack>& tracks);
+  bool trackMarker(R2Image& marker, const MarkerTrack& track, int xReach, int yReach, Point& location, float& ssd);
+  void findMarkersInBoxes(std::vector<R2Image>& markers, const std::vector<int>& boxes, std::vector<Point>& markerLocations, std::vector<float>& markerSSDs);
   void computeHomographyMatrixWithDLT(const std::vector<PointMatch>& matches, std::vector<double>& homographyMatrix) const;
   void warpImageIntoFrame(const std::vector<double>& homographyMatrix, R2Image& otherImage, Frame& frame);
+  void warpImageIntoFrame(const std::vector<double>& homographyMatrix, const R2PlanarImage& otherImage, Frame& frame);
   double calculateOpacity(const double x, const double y, const double borderSize, R2Image& image) const;
+  double calculateOpacity(const double x, const double y, const double borderSize, const int imageWidth, const int imageHeight) const;
   int findSide(const double x, const double y, R2Image& image) const;
+  int findSide(const double x, const double y, const int imageWidth, const int imageHeight) const;
   R2Pixel findSampleColor(const double x, const double y, const double opacity, const double borderWidth, const int side);
   // void* findMarkersThread(void * inputPointer);
   void setMultiThread(bool mode);
+  void setScaleSpaceOctaves(bool mode);
+  void setMarkerNCC(bool mode);
+  void setFeatureANMS(bool mode);
+  void setFeatureFAST(bool mode);
+  void setFeatureBRIEF(bool mode);
+  void setFeatureMatchVerify(bool mode);
+  void printSSDStats(FILE *fp) const;
 
   Point findImageMatch(const Point& searchOrigin, const float searchWindowPercentage, R2Image& comparisonImage);
 
@@ -223,8 +353,8 @@ class R2Image {
   void HighPass(double sigma, double contrast);
 
   // Feature helpers
-  bool shouldInsertFeature(const std::vector<Feature>& features, const Feature& feature, const int minDistance) const;
-  void findScaleInvariantHarrisFeaturePoints(std::vector<Feature>& features, R2Image& image);
+  void findScaleInvariantHarrisFeaturePoints(std::vector<Feature>& features, const R2Image& image);
+  void findScaleInvariantHarrisFeaturePoints(std::vector<Feature>& features, const R2ImageView& view);
   void calculateCharacteristicScales(std::vector<Feature>& features, R2Image& image);
   void classifyMatchesWithRANSAC(std::vector<FeatureMatch>& matches) const;
   bool similarMotion(const FeatureMatch& a, const FeatureMatch& b) const;
@@ -233,14 +363,14 @@ class R2Image {
   void drawMatches(const std::vector<FeatureMatch> matches);
 
   // feature finding
-  void findFeatures(double numFeatures, double minDistance, bool scaleInvariant, R2Image& image, std::vector<Feature>& selectedFeatures);
+  void findFeatures(double numFeatures, double minDistance, bool scaleInvariant, const R2Image& image, std::vector<Feature>& selectedFeatures);
+  void findFeatures(double numFeatures, double minDistance, bool scaleInvariant, const R2ImageView& view, std::vector<Feature>& selectedFeatures);
   FeatureMatch findFeatureMatch(const Feature& feature, R2Image& featureImage, const Point searchOrigin, const float searchAreaPercentage, int ssdSearchRadius);
   FeatureMatch findFeatureMatchConsecutiveImages(const Feature& feature, R2Image& featureImage, const float searchAreaPercentage, int ssdSearchRadius);
-
-  // ssd
-  float ssd(const R2Pixel& a, const R2Pixel& b) const;
-  float calculateSSD(const int x0, const int y0, R2Image& marker); 
-  float calculateSSD(const int x0, const int y0, const int x1, const int y1, R2Image& originalImage, const int ssdCompareReach);
+  FeatureMatch findFeatureMatch(const Feature& feature, const R2LuminanceImage& luminance, const R2LuminanceImage& featureLuminance, const Point searchOrigin, const float searchAreaPercentage, int ssdSearchRadius);
+  FeatureMatch findFeatureMatch(const Feature& feature, const R2Pyramid& pyramid, const R2Pyramid& featurePyramid, const Point searchOrigin, const float searchAreaPercentage, int ssdSearchRadius);
+  FeatureMatch findFeatureMatchConsecutiveImages(const Feature& feature, const R2Pyramid& pyramid, const R2Pyramid& featurePyramid, const float searchAreaPercentage, int ssdSearchRadius);
+  void findDescriptorMatches(const std::vector<Feature>& features, const int numMatches, const int minFeatureDistance, const float searchAreaPercentage, R2Image& originalImage, std::vector<FeatureMatch>& matches);
 
   // helpers
   bool inBounds(const int x, const int y) const;
@@ -280,6 +410,8 @@ class R2Image {
  private:
   // Utility functions
   void Resize(int width, int height);
+  int BufferSize(void) const;
+  void ReleasePixels(void);
   R2Pixel Sample(double u, double v,  int sampling_method);
 
  private:
@@ -287,6 +419,12 @@ class R2Image {
   int npixels;
   int width;
   int height;
+  R2ImageLayout layout;
+  int rowStride;
+  int xstride;
+  int ystride;
+  mutable R2Pyramid *pyramid;
+  R2ImagePixelRelease release;
 };
 
 
@@ -320,12 +458,41 @@ Height(void) const
 
 
 
+inline R2ImageLayout R2Image::
+Layout(void) const
+{
+  // Return memory layout
+  return layout;
+}
+
+
+
+inline int R2Image::
+RowStride(void) const
+{
+  // Return number of pixels between the starts of consecutive rows
+  // (only meaningful for row-major images)
+  return rowStride;
+}
+
+
+
 inline R2Pixel& R2Image::
 Pixel(int x, int y)
 {
   // Return pixel value at (x,y)
-  // (pixels start at lower-left and go in row-major order)
-  return pixels[x*height + y];
+  // (pixels start at lower-left, xstride/ystride encode the layout)
+  if (pyramid) InvalidatePyramid();
+  return pixels[x*xstride + y*ystride];
+}
+
+
+
+inline const R2Pixel& R2Image::
+Pixel(int x, int y) const
+{
+  // Return pixel value at (x,y)
+  return pixels[x*xstride + y*ystride];
 }
 
 
@@ -334,7 +501,8 @@ inline R2Pixel *R2Image::
 Pixels(void)
 {
   // Return pointer to pixels for whole image
-  // (pixels start at lower-left and go in row-major order)
+  // (pixels start at lower-left and are laid out as Layout() says)
+  if (pyramid) InvalidatePyramid();
   return pixels;
 }
 
@@ -343,8 +511,10 @@ Pixels(void)
 inline R2Pixel *R2Image::
 Pixels(int x)
 {
-  // Return pixels pointer for row at x
-  // (pixels start at lower-left and go in row-major order)
+  // Return pixels pointer for column at x
+  // (only valid for column-major images)
+  assert(layout == R2_IMAGE_COLUMN_MAJOR_LAYOUT);
+  if (pyramid) InvalidatePyramid();
   return &pixels[x*height];
 }
 
@@ -353,8 +523,11 @@ Pixels(int x)
 inline R2Pixel *R2Image::
 operator[](int x)
 {
-  // Return pixels pointer for row at x
-  return Pixels(x);
+  // Return pointer to the bottom pixel of column x, pixel (x, y) is y * ystride
+  // pixels on (ystride is 1 in column-major images, so image[x][y] is Pixel(x, y),
+  // and RowStride() in row-major ones)
+  if (pyramid) InvalidatePyramid();
+  return &pixels[x*xstride];
 }
 
 
@@ -362,9 +535,8 @@ operator[](int x)
 inline const R2Pixel *R2Image::
 operator[](int x) const
 {
-  // Return pixels pointer for row at x
-  // (pixels start at lower-left and go in row-major order)
-  return &pixels[x*height];
+  // Return pointer to the bottom pixel of column x (strided as above)
+  return &pixels[x*xstride];
 }
 
 
@@ -373,7 +545,8 @@ inline void R2Image::
 SetPixel(int x, int y, const R2Pixel& pixel)
 {
   // Set pixel
-  pixels[x*height + y] = pixel;
+  if (pyramid) InvalidatePyramid();
+  pixels[x*xstride + y*ystride] = pixel;
 }
 
 
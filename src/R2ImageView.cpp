@@ -0,0 +1,105 @@
+// Source file for non-owning image view class
+
+
+
+// Include files
+
+#include <stdio.h>
+#include <assert.h>
+#include <cmath>
+#include <algorithm>
+#include "R2Pixel.h"
+#include "R2Image.h"
+#include "R2ImageView.h"
+#include "R2PlanarImage.h"
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Constructors
+////////////////////////////////////////////////////////////////////////
+
+R2ImageView::
+R2ImageView(void)
+  : origin(NULL),
+    width(0),
+    height(0),
+    xstride(0),
+    ystride(0),
+    x0(0),
+    y0(0)
+{
+}
+
+
+
+R2ImageView::
+R2ImageView(R2Pixel *origin, int width, int height, int xstride, int ystride, int x0, int y0)
+  : origin(origin),
+    width(width),
+    height(height),
+    xstride(xstride),
+    ystride(ystride),
+    x0(x0),
+    y0(y0)
+{
+}
+
+
+
+R2ImageView R2ImageView::
+View(int x, int y, int w, int h) const
+{
+  // Clip the requested rectangle to this view
+  const int xEnd = std::min(x + w, width);
+  const int yEnd = std::min(y + h, height);
+  x = std::max(x, 0);
+  y = std::max(y, 0);
+  w = std::max(xEnd - x, 0);
+  h = std::max(yEnd - y, 0);
+  if ((w == 0) || (h == 0)) return R2ImageView(origin, 0, 0, xstride, ystride, x0, y0);
+
+  // Sub-view shares the pixels
+  return R2ImageView(&Pixel(x, y), w, h, xstride, ystride, x0 + x, y0 + y);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Linear filtering
+////////////////////////////////////////////////////////////////////////
+
+void R2ImageView::
+applyFilter3x3(int filter[3][3])
+{
+  // 3x3 filter of the view only, run on float planes a row at a time
+  if ((width == 0) || (height == 0)) return;
+  R2PlanarImage planes(*this);
+  planes.applyFilter3x3(filter);
+  planes.ToImage(*this);
+}
+
+
+
+void R2ImageView::
+Blur(double sigma, bool clamped)
+{
+  // Gaussian blur of the view only (pixels outside the view are not read),
+  // run on float planes with the vectorized row kernels of R2BlurPlane
+  if ((width == 0) || (height == 0)) return;
+  R2PlanarImage planes(*this);
+  planes.Blur(sigma, clamped);
+  planes.ToImage(*this);
+}
+
+
+
+void R2ImageView::
+Harris(double sigma, bool clamped)
+{
+  // Harris response of the view only, computed on planes and written back in place
+  if ((width == 0) || (height == 0)) return;
+  R2PlanarImage harris(*this);
+  harris.Harris(sigma, clamped);
+  harris.ToImage(*this);
+}
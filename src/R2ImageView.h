@@ -0,0 +1,147 @@
+// Include file for non-owning image view class
+#ifndef R2_IMAGE_VIEW_INCLUDED
+#define R2_IMAGE_VIEW_INCLUDED
+
+
+
+// Class definition
+
+class R2Image;
+class R2Pixel;
+
+// A rectangular window onto pixels owned by someone else (normally an R2Image).
+// Nothing is copied: Pixel(x, y) reads and writes the underlying image at
+// (X0() + x, Y0() + y). The view must not outlive the image it looks at.
+class R2ImageView {
+ public:
+  // Constructors
+  R2ImageView(void);
+  R2ImageView(R2Pixel *origin, int width, int height, int xstride, int ystride, int x0 = 0, int y0 = 0);
+
+  // View properties
+  int Width(void) const;
+  int Height(void) const;
+  int NPixels(void) const;
+  int X0(void) const;
+  int Y0(void) const;
+  int XStride(void) const;
+  int YStride(void) const;
+  bool IsRowContiguous(void) const;
+
+  // Pixel access/update (view coordinates)
+  R2Pixel& Pixel(int x, int y) const;
+  bool inBounds(const int x, const int y) const;
+
+  // Sub-views (clipped to this view)
+  R2ImageView View(int x0, int y0, int width, int height) const;
+
+  // Linear filtering operations (in place, the view is treated as a whole image)
+  void applyFilter3x3(int filter[3][3]);
+  void Blur(double sigma, bool clamped);
+  void Harris(double sigma, bool clamped);
+
+ private:
+  R2Pixel *origin;
+  int width;
+  int height;
+  int xstride;
+  int ystride;
+  int x0;
+  int y0;
+};
+
+
+
+// Inline functions
+
+inline int R2ImageView::
+Width(void) const
+{
+  // Return width
+  return width;
+}
+
+
+
+inline int R2ImageView::
+Height(void) const
+{
+  // Return height
+  return height;
+}
+
+
+
+inline int R2ImageView::
+NPixels(void) const
+{
+  // Return number of pixels in the view
+  return width * height;
+}
+
+
+
+inline int R2ImageView::
+X0(void) const
+{
+  // Return x of the view origin in the underlying image
+  return x0;
+}
+
+
+
+inline int R2ImageView::
+Y0(void) const
+{
+  // Return y of the view origin in the underlying image
+  return y0;
+}
+
+
+
+inline int R2ImageView::
+XStride(void) const
+{
+  // Return pixel distance between horizontal neighbors
+  return xstride;
+}
+
+
+
+inline int R2ImageView::
+YStride(void) const
+{
+  // Return pixel distance between vertical neighbors
+  return ystride;
+}
+
+
+
+inline bool R2ImageView::
+IsRowContiguous(void) const
+{
+  // Return whether rows (rather than columns) are contiguous in memory
+  return xstride <= ystride;
+}
+
+
+
+inline R2Pixel& R2ImageView::
+Pixel(int x, int y) const
+{
+  // Return pixel value at (x,y) of the view
+  return origin[x*xstride + y*ystride];
+}
+
+
+
+inline bool R2ImageView::
+inBounds(const int x, const int y) const
+{
+  // Return whether (x,y) is inside the view
+  return (x >= 0) && (x < width) && (y >= 0) && (y < height);
+}
+
+
+
+#endif
@@ -0,0 +1,1218 @@
+// Source file for planar float image class
+
+
+
+// Include files
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <cmath>
+#include <utility>
+#include <algorithm>
+#include <vector>
+#include <complex>
+#include "R2Pixel.h"
+#include "R2Image.h"
+#include "R2ImageView.h"
+#include "R2PlanarImage.h"
+#include "R2SummedAreaTable.h"
+#include "R2BufferPool.h"
+#include "R2Blur.h"
+#include "R2FFT.h"
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Memory helpers
+////////////////////////////////////////////////////////////////////////
+
+static float *
+AllocateFloats(size_t count)
+{
+  // Draw count floats from the calling thread's pool
+  // (pool buffers start on a R2_BUFFER_POOL_ALIGNMENT boundary)
+  return (float *) R2BufferPool::ThreadPool().Allocate(count * sizeof(float));
+}
+
+
+
+static void
+FreeFloats(float *p, size_t count)
+{
+  // Return memory from AllocateFloats to the calling thread's pool
+  R2BufferPool::ThreadPool().Release(p, count * sizeof(float));
+}
+
+
+
+static int
+PaddedStride(int width)
+{
+  // Round row length up so every row starts on an aligned boundary
+  const int a = R2_PLANAR_IMAGE_ROW_ALIGNMENT;
+  return ((width + a - 1) / a) * a;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Constructors/Destructors
+////////////////////////////////////////////////////////////////////////
+
+R2PlanarImage::
+R2PlanarImage(void)
+  : data(NULL),
+    nchannels(0),
+    width(0),
+    height(0),
+    stride(0)
+{
+}
+
+
+
+R2PlanarImage::
+R2PlanarImage(int width, int height, int nchannels)
+  : data(NULL),
+    nchannels(0),
+    width(0),
+    height(0),
+    stride(0)
+{
+  // Allocate zeroed planes
+  Resize(width, height, nchannels);
+}
+
+
+
+R2PlanarImage::
+R2PlanarImage(const R2Image& image)
+  : data(NULL),
+    nchannels(0),
+    width(0),
+    height(0),
+    stride(0)
+{
+  // Convert pixels into planes
+  FromImage(image);
+}
+
+
+
+R2PlanarImage::
+R2PlanarImage(const R2ImageView& view)
+  : data(NULL),
+    nchannels(0),
+    width(0),
+    height(0),
+    stride(0)
+{
+  // Convert pixels under the view into planes
+  FromImage(view);
+}
+
+
+
+R2PlanarImage::
+R2PlanarImage(const R2PlanarImage& image)
+  : data(NULL),
+    nchannels(0),
+    width(0),
+    height(0),
+    stride(0)
+{
+  // Copy planes
+  *this = image;
+}
+
+
+
+R2PlanarImage::
+R2PlanarImage(R2PlanarImage&& image) noexcept
+  : data(image.data),
+    nchannels(image.nchannels),
+    width(image.width),
+    height(image.height),
+    stride(image.stride)
+{
+  // Steal planes, leave image empty
+  image.data = NULL;
+  image.nchannels = image.width = image.height = image.stride = 0;
+}
+
+
+
+R2PlanarImage::
+~R2PlanarImage(void)
+{
+  // Free planes
+  FreeFloats(data, (size_t) nchannels * stride * height);
+}
+
+
+
+R2PlanarImage& R2PlanarImage::
+operator=(const R2PlanarImage& image)
+{
+  // Check for self assignment
+  if (this == &image) return *this;
+
+  // Copy planes (padding included)
+  Resize(image.width, image.height, image.nchannels);
+  memcpy(data, image.data, (size_t) nchannels * stride * height * sizeof(float));
+
+  // Return image
+  return *this;
+}
+
+
+
+R2PlanarImage& R2PlanarImage::
+operator=(R2PlanarImage&& image) noexcept
+{
+  // Take over planes, the old ones go away with image
+  swap(image);
+
+  // Return image
+  return *this;
+}
+
+
+
+void R2PlanarImage::
+swap(R2PlanarImage& image) noexcept
+{
+  // Exchange planes and shape without copying
+  std::swap(data, image.data);
+  std::swap(nchannels, image.nchannels);
+  std::swap(width, image.width);
+  std::swap(height, image.height);
+  std::swap(stride, image.stride);
+}
+
+
+
+void R2PlanarImage::
+Resize(int w, int h, int n)
+{
+  // Reallocate only if the shape changes
+  if ((w == width) && (h == height) && (n == nchannels) && data) {
+    memset(data, 0, (size_t) nchannels * stride * height * sizeof(float));
+    return;
+  }
+
+  // Allocate zeroed planes
+  FreeFloats(data, (size_t) nchannels * stride * height);
+  width = w;
+  height = h;
+  nchannels = n;
+  stride = PaddedStride(w);
+  const size_t count = (size_t) nchannels * stride * height;
+  data = AllocateFloats(count);
+  if (data) memset(data, 0, count * sizeof(float));
+}
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Conversion
+////////////////////////////////////////////////////////////////////////
+
+R2Pixel R2PlanarImage::
+Pixel(int x, int y) const
+{
+  // Assemble a pixel from the planes (missing color planes repeat the first one)
+  double c[4] = { 0, 0, 0, 1 };
+  for (int k = 0; k < 3; k++) {
+    c[k] = Value((k < nchannels) ? k : 0, x, y);
+  }
+  if (nchannels == 4) c[3] = Value(3, x, y);
+  return R2Pixel(c);
+}
+
+
+
+void R2PlanarImage::
+SetPixel(int x, int y, const R2Pixel& pixel)
+{
+  // Scatter pixel into the planes (single plane images store luminance)
+  if (nchannels == 1) {
+    Value(0, x, y) = pixel.Luminance();
+    return;
+  }
+  for (int c = 0; c < nchannels; c++) {
+    Value(c, x, y) = pixel[c];
+  }
+}
+
+
+
+void R2PlanarImage::
+FromImage(const R2Image& image)
+{
+  // Convert the whole image (the view is only read)
+  FromImage(image.View());
+}
+
+
+
+void R2PlanarImage::
+FromImage(const R2ImageView& view)
+{
+  // Convert pixels into four planes, reading the view in its image's memory order
+  Resize(view.Width(), view.Height(), 4);
+  if (view.IsRowContiguous()) {
+    for (int y = 0; y < height; y++) {
+      const R2Pixel *row = &view.Pixel(0, y);
+      for (int c = 0; c < 4; c++) {
+        float *out = Row(c, y);
+        for (int x = 0; x < width; x++) {
+          out[x] = row[x * view.XStride()][c];
+        }
+      }
+    }
+  }
+  else {
+    for (int x = 0; x < width; x++) {
+      const R2Pixel *column = &view.Pixel(x, 0);
+      for (int c = 0; c < 4; c++) {
+        float *plane = Plane(c);
+        for (int y = 0; y < height; y++) {
+          plane[y * stride + x] = column[y * view.YStride()][c];
+        }
+      }
+    }
+  }
+}
+
+
+
+void R2PlanarImage::
+FromLuminance(const R2ImageView& view)
+{
+  // Convert pixels into one plane of R2Pixel::Luminance() values. Rows are read
+  // as flat arrays of doubles (R2Pixel is four of them) so the loop vectorizes.
+  assert(sizeof(R2Pixel) == 4 * sizeof(double));
+  Resize(view.Width(), view.Height(), 1);
+  if (view.IsRowContiguous()) {
+    assert(view.XStride() == 1);
+    for (int y = 0; y < height; y++) {
+      const double *p = (const double *) &view.Pixel(0, y);
+      float *out = Row(0, y);
+      for (int x = 0; x < width; x++) {
+        out[x] = (float) (0.30 * p[4*x] + 0.59 * p[4*x+1] + 0.11 * p[4*x+2]);
+      }
+    }
+  }
+  else {
+    assert(view.YStride() == 1);
+    float *plane = Plane(0);
+    for (int x = 0; x < width; x++) {
+      const double *p = (const double *) &view.Pixel(x, 0);
+      for (int y = 0; y < height; y++) {
+        plane[y * stride + x] = (float) (0.30 * p[4*y] + 0.59 * p[4*y+1] + 0.11 * p[4*y+2]);
+      }
+    }
+  }
+}
+
+
+
+void R2PlanarImage::
+ToImage(R2Image& image) const
+{
+  // Convert planes back into pixels (image keeps its layout)
+  if ((image.Width() != width) || (image.Height() != height)) {
+    image = R2Image(width, height, image.Layout(), image.RowStride());
+  }
+  ToImage(image.View());
+}
+
+
+
+void R2PlanarImage::
+ToImage(const R2ImageView& view) const
+{
+  // Write planes into the pixels under the view (sizes must match)
+  assert((view.Width() == width) && (view.Height() == height));
+  if (view.IsRowContiguous()) {
+    for (int y = 0; y < height; y++) {
+      for (int x = 0; x < width; x++) {
+        view.Pixel(x, y) = Pixel(x, y);
+      }
+    }
+  }
+  else {
+    for (int x = 0; x < width; x++) {
+      for (int y = 0; y < height; y++) {
+        view.Pixel(x, y) = Pixel(x, y);
+      }
+    }
+  }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Plane kernels
+////////////////////////////////////////////////////////////////////////
+
+// Apply a 3x3 filter to one row of a plane. R2Image::applyFilter3x3 runs on
+// this and keeps its original border handling: the left column and bottom row
+// keep their values and the right column and top row are zeroed.
+static void
+FilterRow3x3(const float *src, float *out, int j, int width, int height, int stride, int filter[3][3])
+{
+  // Keep the row as is on the bottom and top, the left column elsewhere
+  const float *row = &src[j * stride];
+  if ((j == 0) || (j == height - 1)) {
+    memcpy(out, row, width * sizeof(float));
+  }
+  else {
+    // Interior (filter[a][b] weighs the pixel at (x - 1 + a, y - 1 + b))
+    const float *below = row - stride;
+    const float *above = row + stride;
+    out[0] = row[0];
+    for (int i = 1; i < width - 1; i++) {
+      out[i] =
+        filter[0][0] * below[i - 1] + filter[1][0] * below[i] + filter[2][0] * below[i + 1] +
+        filter[0][1] * row[i - 1]   + filter[1][1] * row[i]   + filter[2][1] * row[i + 1] +
+        filter[0][2] * above[i - 1] + filter[1][2] * above[i] + filter[2][2] * above[i + 1];
+    }
+  }
+
+  // Zero the rest of the border
+  if (j == height - 1) {
+    for (int i = 1; i < width; i++) out[i] = 0;
+  }
+  if (j >= 1) out[width - 1] = 0;
+}
+
+
+
+static void
+FilterPlane3x3(const float *src, float *dst, int width, int height, int stride, int filter[3][3])
+{
+  // Apply a 3x3 filter to one plane, row by row
+  for (int j = 0; j < height; j++) {
+    FilterRow3x3(src, &dst[j * stride], j, width, height, stride, filter);
+  }
+}
+
+
+
+static inline float
+ClampValue(float v)
+{
+  // Clamp to [0, 1] like R2Pixel::Clamp
+  if (v > 1) v = 1;
+  if (v < 0) v = 0;
+  return v;
+}
+
+
+
+static int
+BuildGaussianKernel(double sigma, float *kernel)
+{
+  // Fill kernel with 2 * reach + 1 taps (same sampling as R2Image::Blur), return reach
+  const int kernelReach = 3 * sigma;
+  for (int i = -kernelReach; i <= kernelReach; i++) {
+    double frac = 1.0 / (sqrt(2.0 * M_PI) * sigma);
+    double expo = exp(-(i * i) / (2.0 * sigma * sigma));
+    kernel[i + kernelReach] = frac * expo;
+  }
+  return kernelReach;
+}
+
+
+
+static void
+GaussianPlane(float *plane, float *temp, int width, int height, int stride, double sigma, const float *kernel, int kernelReach, bool clamped)
+{
+  // Recursive filter from the threshold sigma up, where it is cheaper than the kernel
+  if (sigma >= R2BlurGetRecursiveSigma()) R2RecursiveBlurPlane(plane, temp, width, height, stride, sigma, clamped);
+  else R2BlurPlane(plane, temp, width, height, stride, kernel, kernelReach, clamped);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Linear filtering
+////////////////////////////////////////////////////////////////////////
+
+void R2PlanarImage::
+applyFilter3x3(int filter[3][3])
+{
+  // Filter every plane through one scratch plane
+  float *temp = AllocateFloats((size_t) stride * height);
+  for (int c = 0; c < nchannels; c++) {
+    FilterPlane3x3(Plane(c), temp, width, height, stride, filter);
+    memcpy(Plane(c), temp, (size_t) stride * height * sizeof(float));
+  }
+  FreeFloats(temp, (size_t) stride * height);
+}
+
+
+
+void R2PlanarImage::
+SobelX(void)
+{
+  int sobelX[3][3] = {
+    {1, 0, -1},
+    {2, 0, -2},
+    {1, 0, -1}
+  };
+
+  applyFilter3x3(sobelX);
+}
+
+
+
+void R2PlanarImage::
+SobelY(void)
+{
+  int sobelY[3][3] = {
+    {-1, -2, -1},
+    {0, 0, 0},
+    {1, 2, 1}
+  };
+
+  applyFilter3x3(sobelY);
+}
+
+
+
+void R2PlanarImage::
+Blur(double sigma, bool clamped)
+{
+  // Construct kernel
+  const int kernelLength = 2 * (int) (3 * sigma) + 1;
+  float *kernel = AllocateFloats(kernelLength);
+  const int kernelReach = BuildGaussianKernel(sigma, kernel);
+
+  // Blur every plane through one scratch plane
+  float *temp = AllocateFloats((size_t) stride * height);
+  for (int c = 0; c < nchannels; c++) {
+    GaussianPlane(Plane(c), temp, width, height, stride, sigma, kernel, kernelReach, clamped);
+  }
+
+  FreeFloats(temp, (size_t) stride * height);
+  FreeFloats(kernel, kernelLength);
+}
+
+
+
+static void
+HarrisResponse(const float *xx, const float *yy, const float *xy, float *out, int n, bool clamped)
+{
+  // Corner response from smoothed structure tensor products
+  for (int i = 0; i < n; i++) {
+    const float trace = xx[i] + yy[i];
+    float r = xx[i] * yy[i] - xy[i] * xy[i] - 0.04f * trace * trace + 0.5f;
+    out[i] = (clamped) ? ClampValue(r) : r;
+  }
+}
+
+
+
+static void
+HarrisPlaneBand(float *plane, int width, int height, int stride, double sigma, bool clamped)
+{
+  // Streaming Harris for kernel sized sigmas: each row of gradients and products
+  // is made once and blurred horizontally into a ring of rows, and output row j
+  // is the vertical blur of the ring as soon as it holds rows j - reach to
+  // j + reach. Scratch is a band of rows, not whole planes. Output rows lag the
+  // input by one more row, so plane can be overwritten in place (gradients of
+  // row r read rows r - 1 to r + 1).
+  int sobelX[3][3] = { {1, 0, -1}, {2, 0, -2}, {1, 0, -1} };
+  int sobelY[3][3] = { {-1, -2, -1}, {0, 0, 0}, {1, 2, 1} };
+
+  // Normalized kernel and border renormalization
+  const int kernelLength = 2 * (int) (3 * sigma) + 1;
+  float *kernel = AllocateFloats(kernelLength);
+  const int reach = BuildGaussianKernel(sigma, kernel);
+  float kernelSum = 0;
+  for (int a = 0; a < kernelLength; a++) kernelSum += kernel[a];
+  for (int a = 0; a < kernelLength; a++) kernel[a] /= kernelSum;
+  const float *k = &kernel[reach];
+  float *rowScales = AllocateFloats(height);
+  float *columnScales = AllocateFloats(width);
+  R2BlurBorderScales(k, reach, height, rowScales);
+  R2BlurBorderScales(k, reach, width, columnScales);
+
+  // Ring of horizontally blurred products, one row longer than the kernel as
+  // row j + reach + 1 is made before row j is output. Row r is kept in slot
+  // r % ringRows and again ringRows slots later, so any ringRows consecutive
+  // rows are contiguous slots and the vertical blur can step through them.
+  const int ringRows = 2 * reach + 2;
+  const size_t ringSize = (size_t) 2 * ringRows * stride;
+  float *ringXX = AllocateFloats(ringSize);
+  float *ringYY = AllocateFloats(ringSize);
+  float *ringXY = AllocateFloats(ringSize);
+  float *rows = AllocateFloats((size_t) 6 * stride);
+  float *dx = &rows[0], *dy = &rows[stride], *pxy = &rows[2 * stride];
+  float *sxx = &rows[3 * stride], *syy = &rows[4 * stride], *sxy = &rows[5 * stride];
+
+  int next = 0;
+  for (int j = 0; j < height; j++) {
+    // Bring the ring up to row j + reach + 1
+    const int last = (j + reach + 1 < height) ? j + reach + 1 : height - 1;
+    for (; next <= last; next++) {
+      FilterRow3x3(plane, dx, next, width, height, stride, sobelX);
+      FilterRow3x3(plane, dy, next, width, height, stride, sobelY);
+      for (int i = 0; i < width; i++) {
+        pxy[i] = dx[i] * dy[i];
+        dx[i] *= dx[i];
+        dy[i] *= dy[i];
+      }
+      const size_t slot = (size_t) (next % ringRows) * stride;
+      const size_t copy = slot + (size_t) ringRows * stride;
+      R2BlurAlongRow(dx, &ringXX[slot], width, k, reach, columnScales, false);
+      R2BlurAlongRow(dy, &ringYY[slot], width, k, reach, columnScales, false);
+      R2BlurAlongRow(pxy, &ringXY[slot], width, k, reach, columnScales, false);
+      memcpy(&ringXX[copy], &ringXX[slot], width * sizeof(float));
+      memcpy(&ringYY[copy], &ringYY[slot], width * sizeof(float));
+      memcpy(&ringXY[copy], &ringXY[slot], width * sizeof(float));
+    }
+
+    // Vertical blur of rows j + lo to j + hi - 1, then the response
+    const int lo = (j - reach < 0) ? -j : -reach;
+    const int hi = (j + reach + 1 > height) ? height - j : reach + 1;
+    const float scale = ((lo == -reach) && (hi == reach + 1)) ? 1.0f : rowScales[j];
+    const size_t center = (size_t) ((j + lo) % ringRows - lo) * stride;
+    R2BlurAcrossRows(&ringXX[center], stride, lo, hi, k, scale, sxx, width, false);
+    R2BlurAcrossRows(&ringYY[center], stride, lo, hi, k, scale, syy, width, false);
+    R2BlurAcrossRows(&ringXY[center], stride, lo, hi, k, scale, sxy, width, false);
+    HarrisResponse(sxx, syy, sxy, &plane[j * stride], width, clamped);
+  }
+
+  FreeFloats(rows, (size_t) 6 * stride);
+  FreeFloats(ringXX, ringSize);
+  FreeFloats(ringYY, ringSize);
+  FreeFloats(ringXY, ringSize);
+  FreeFloats(rowScales, height);
+  FreeFloats(columnScales, width);
+  FreeFloats(kernel, kernelLength);
+}
+
+
+
+static void
+HarrisPlaneRecursive(float *plane, int width, int height, int stride, double sigma, bool clamped)
+{
+  // Harris with whole plane products, for sigmas blurred recursively (the
+  // recursive filter needs complete columns, so it cannot run on a band)
+  int sobelX[3][3] = { {1, 0, -1}, {2, 0, -2}, {1, 0, -1} };
+  int sobelY[3][3] = { {-1, -2, -1}, {0, 0, 0}, {1, 2, 1} };
+
+  const size_t planeSize = (size_t) stride * height;
+  float *xx = AllocateFloats(planeSize);
+  float *yy = AllocateFloats(planeSize);
+  float *xy = AllocateFloats(planeSize);
+  float *temp = AllocateFloats(planeSize);
+
+  // Gradients, then structure tensor products
+  FilterPlane3x3(plane, xx, width, height, stride, sobelX);
+  FilterPlane3x3(plane, yy, width, height, stride, sobelY);
+  for (size_t k = 0; k < planeSize; k++) {
+    const float dx = xx[k];
+    const float dy = yy[k];
+    xy[k] = dx * dy;
+    xx[k] = dx * dx;
+    yy[k] = dy * dy;
+  }
+
+  // Smooth products, then corner response
+  R2RecursiveBlurPlane(xx, temp, width, height, stride, sigma, false);
+  R2RecursiveBlurPlane(yy, temp, width, height, stride, sigma, false);
+  R2RecursiveBlurPlane(xy, temp, width, height, stride, sigma, false);
+  for (int j = 0; j < height; j++) {
+    const size_t row = (size_t) j * stride;
+    HarrisResponse(&xx[row], &yy[row], &xy[row], &plane[row], width, clamped);
+  }
+
+  FreeFloats(xx, planeSize);
+  FreeFloats(yy, planeSize);
+  FreeFloats(xy, planeSize);
+  FreeFloats(temp, planeSize);
+}
+
+
+
+void R2PlanarImage::
+Harris(double sigma, bool clamped)
+{
+  // Harris corner detector on every color plane, one plane at a time.
+  // Output is 50% grey at flat regions, white at corners and dark near edges.
+  if ((width == 0) || (height == 0)) return;
+  const int colorChannels = (nchannels < 3) ? nchannels : 3;
+  for (int c = 0; c < colorChannels; c++) {
+    if (sigma >= R2BlurGetRecursiveSigma()) HarrisPlaneRecursive(Plane(c), width, height, stride, sigma, clamped);
+    else HarrisPlaneBand(Plane(c), width, height, stride, sigma, clamped);
+  }
+
+  // Response is opaque
+  const size_t planeSize = (size_t) stride * height;
+  for (int c = colorChannels; c < nchannels; c++) {
+    float *plane = Plane(c);
+    for (size_t k = 0; k < planeSize; k++) plane[k] = 1;
+  }
+}
+
+
+
+void R2PlanarImage::
+StructureTensor(R2PlanarImage& tensor) const
+{
+  // Unsmoothed structure tensor of the first plane: dx * dx, dy * dy and dx * dy
+  // planes from the same Sobel gradients Harris uses
+  int sobelX[3][3] = { {1, 0, -1}, {2, 0, -2}, {1, 0, -1} };
+  int sobelY[3][3] = { {-1, -2, -1}, {0, 0, 0}, {1, 2, 1} };
+  tensor.Resize(width, height, 3);
+  for (int j = 0; j < height; j++) {
+    float *xx = tensor.Row(0, j);
+    float *yy = tensor.Row(1, j);
+    float *xy = tensor.Row(2, j);
+    FilterRow3x3(Plane(0), xx, j, width, height, stride, sobelX);
+    FilterRow3x3(Plane(0), yy, j, width, height, stride, sobelY);
+    for (int i = 0; i < width; i++) {
+      xy[i] = xx[i] * yy[i];
+      xx[i] *= xx[i];
+      yy[i] *= yy[i];
+    }
+  }
+}
+
+
+
+void R2PlanarImage::
+HarrisFromTensor(const R2PlanarImage& tensor, bool clamped)
+{
+  // Single plane of corner responses from a smoothed structure tensor
+  assert(tensor.NChannels() == 3);
+  Resize(tensor.Width(), tensor.Height(), 1);
+  for (int j = 0; j < height; j++) {
+    HarrisResponse(tensor.Row(0, j), tensor.Row(1, j), tensor.Row(2, j), Row(0, j), width, clamped);
+  }
+}
+
+
+
+void R2PlanarImage::
+Downsample(R2PlanarImage& half) const
+{
+  // Every other sample of every other row (the planes should be smooth enough
+  // not to alias, no filtering is done here)
+  half.Resize((width + 1) / 2, (height + 1) / 2, nchannels);
+  for (int c = 0; c < nchannels; c++) {
+    for (int j = 0; j < half.Height(); j++) {
+      const float *in = Row(c, 2 * j);
+      float *out = half.Row(c, j);
+      for (int i = 0; i < half.Width(); i++) out[i] = in[2 * i];
+    }
+  }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////
+// SSD
+////////////////////////////////////////////////////////////////////////
+
+float R2PlanarImage::
+calculateSSD(const int x0, const int y0, const R2PlanarImage& marker) const
+{
+  // Sum of squared color differences between marker and the window centered at (x0, y0)
+  // (window is exactly the marker, so even sized markers extend one less to the right/top)
+  const int xReach = marker.Width() / 2;
+  const int yReach = marker.Height() / 2;
+  const int xEnd = marker.Width() - xReach;
+  const int yEnd = marker.Height() - yReach;
+  const int colorChannels = (nchannels < 3) ? nchannels : 3;
+
+  // Fast path when the whole window is inside the image
+  const bool inside = (x0 - xReach >= 0) && (x0 + xEnd <= width) && (y0 - yReach >= 0) && (y0 + yEnd <= height);
+
+  float sum = 0;
+  for (int c = 0; c < colorChannels; c++) {
+    for (int j = -yReach; j < yEnd; j++) {
+      const float *m = marker.Row(c, yReach + j) + xReach;
+      if (inside) {
+        const float *f = Row(c, y0 + j) + x0;
+        for (int i = -xReach; i < xEnd; i++) {
+          const float d = f[i] - m[i];
+          sum += d * d;
+        }
+      }
+      else {
+        for (int i = -xReach; i < xEnd; i++) {
+          if (inBounds(x0 + i, y0 + j)) {
+            const float d = Value(c, x0 + i, y0 + j) - m[i];
+            sum += d * d;
+          } else {
+            // account for out of bounds pixels by adding max possible ssd
+            sum += 1;
+          }
+        }
+      }
+    }
+  }
+  return sum;
+}
+
+
+
+void R2PlanarImage::
+calculateSSDSurface(const int xMin, const int yMin, const int xMax, const int yMax, const R2PlanarImage& marker, float *ssds) const
+{
+  // calculateSSD(x, y, marker) for every (x, y) of the box, row by row into ssds,
+  // from sum(f^2) - 2 sum(f m) + sum(m^2) over the part of each window inside the
+  // image (plus 1 per channel for every pixel outside). The cross term of all
+  // windows comes from one FFT correlation, the squares from summed area tables.
+  const int w = xMax - xMin;
+  const int h = yMax - yMin;
+  if ((w <= 0) || (h <= 0)) return;
+  const int mw = marker.Width();
+  const int mh = marker.Height();
+  const int xReach = mw / 2;
+  const int yReach = mh / 2;
+  const int colorChannels = (nchannels < 3) ? nchannels : 3;
+
+  // Image area the windows cover (zero outside the image), and the transform size
+  const int sx0 = xMin - xReach;
+  const int sy0 = yMin - yReach;
+  const int sw = w + mw - 1;
+  const int sh = h + mh - 1;
+  const int fw = R2FFTSize(sw);
+  const int fh = R2FFTSize(sh);
+  std::vector<std::complex<double> > covered((size_t) fw * fh), kernel((size_t) fw * fh);
+  std::vector<double> coveredSquares((size_t) (sw + 1) * (sh + 1));
+  std::vector<double> markerSquares((size_t) (mw + 1) * (mh + 1));
+  std::vector<double> sums((size_t) w * h, 0.0);
+
+  for (int c = 0; c < colorChannels; c++) {
+    // Covered area and its summed area table of squares
+    std::fill(covered.begin(), covered.end(), std::complex<double>(0, 0));
+    for (int j = 0; j < sh; j++) {
+      double rowSum = 0;
+      for (int i = 0; i < sw; i++) {
+        const double f = inBounds(sx0 + i, sy0 + j) ? Value(c, sx0 + i, sy0 + j) : 0;
+        covered[(size_t) j * fw + i] = f;
+        rowSum += f * f;
+        coveredSquares[(size_t) (j + 1) * (sw + 1) + i + 1] = coveredSquares[(size_t) j * (sw + 1) + i + 1] + rowSum;
+      }
+    }
+
+    // Marker and its summed area table of squares
+    std::fill(kernel.begin(), kernel.end(), std::complex<double>(0, 0));
+    for (int j = 0; j < mh; j++) {
+      double rowSum = 0;
+      for (int i = 0; i < mw; i++) {
+        const double m = marker.Value(c, i, j);
+        kernel[(size_t) j * fw + i] = m;
+        rowSum += m * m;
+        markerSquares[(size_t) (j + 1) * (mw + 1) + i + 1] = markerSquares[(size_t) j * (mw + 1) + i + 1] + rowSum;
+      }
+    }
+
+    // Cross correlation: covered (*) conj(marker) in the frequency domain
+    R2FFT2D(covered.data(), fw, fh, false);
+    R2FFT2D(kernel.data(), fw, fh, false);
+    for (size_t k = 0; k < covered.size(); k++) covered[k] *= std::conj(kernel[k]);
+    R2FFT2D(covered.data(), fw, fh, true);
+
+    // Combine per window (u, v is the window corner in the covered area)
+    for (int v = 0; v < h; v++) {
+      for (int u = 0; u < w; u++) {
+        // Window rows/columns inside the image, in marker coordinates
+        const int i0 = std::max(0, -(sx0 + u));
+        const int j0 = std::max(0, -(sy0 + v));
+        const int i1 = std::min(mw, width - (sx0 + u));
+        const int j1 = std::min(mh, height - (sy0 + v));
+        double sum = (double) mw * mh;
+        if ((i1 > i0) && (j1 > j0)) {
+          const double ff =
+            coveredSquares[(size_t) (v + j1) * (sw + 1) + u + i1] - coveredSquares[(size_t) (v + j0) * (sw + 1) + u + i1] -
+            coveredSquares[(size_t) (v + j1) * (sw + 1) + u + i0] + coveredSquares[(size_t) (v + j0) * (sw + 1) + u + i0];
+          const double mm =
+            markerSquares[(size_t) j1 * (mw + 1) + i1] - markerSquares[(size_t) j0 * (mw + 1) + i1] -
+            markerSquares[(size_t) j1 * (mw + 1) + i0] + markerSquares[(size_t) j0 * (mw + 1) + i0];
+          const double fm = covered[(size_t) v * fw + u].real();
+          sum = ff - 2 * fm + mm + (double) mw * mh - (double) (i1 - i0) * (j1 - j0);
+        }
+        sums[(size_t) v * w + u] += sum;
+      }
+    }
+  }
+
+  for (size_t k = 0; k < sums.size(); k++) ssds[k] = (float) std::max(sums[k], 0.0);
+}
+
+
+
+float R2PlanarImage::
+calculateSSD(const int x0, const int y0, const int x1, const int y1, const R2PlanarImage& otherImage, const int ssdSearchRadius) const
+{
+  // Sum of squared differences between the (2 * ssdSearchRadius + 1)^2 windows
+  // centered at (x0, y0) here and (x1, y1) in otherImage
+  const int colorChannels = std::min((nchannels < 3) ? nchannels : 3, otherImage.NChannels());
+  float sum = 0;
+  for (int c = 0; c < colorChannels; c++) {
+    for (int j = -ssdSearchRadius; j < ssdSearchRadius + 1; j++) {
+      for (int i = -ssdSearchRadius; i < ssdSearchRadius + 1; i++) {
+        if (inBounds(x0 + i, y0 + j) && otherImage.inBounds(x1 + i, y1 + j)) {
+          const float d = Value(c, x0 + i, y0 + j) - otherImage.Value(c, x1 + i, y1 + j);
+          sum += d * d;
+        } else {
+          // account for out of bounds pixels by adding max possible ssd
+          sum += 1;
+        }
+      }
+    }
+  }
+  return sum;
+}
+
+
+
+float R2PlanarImage::
+calculateSSD(const int x0, const int y0, const R2PlanarImage& marker, const int *rowOrder, const float bound) const
+{
+  // calculateSSD(x0, y0, marker) one marker row at a time in rowOrder, giving up
+  // once the sum exceeds bound
+  const int xReach = marker.Width() / 2;
+  const int yReach = marker.Height() / 2;
+  const int xEnd = marker.Width() - xReach;
+  const int colorChannels = (nchannels < 3) ? nchannels : 3;
+  const int markerChannels = (marker.NChannels() < 3) ? marker.NChannels() : 3;
+
+  // Marker columns over the image, the rest add the max of 1 per pixel
+  const int iMin = std::max(-xReach, -x0);
+  const int iMax = std::min(xEnd, width - x0);
+  const int outside = (iMax > iMin) ? marker.Width() - (iMax - iMin) : marker.Width();
+
+  float sum = 0;
+  for (int k = 0; k < markerChannels * marker.Height(); k++) {
+    const int c = rowOrder[k] / marker.Height();
+    const int y = y0 + rowOrder[k] % marker.Height() - yReach;
+    if (c >= colorChannels) continue;
+    if ((y < 0) || (y >= height) || (iMax <= iMin)) {
+      sum += marker.Width();
+    }
+    else {
+      const float *f = Row(c, y) + x0;
+      const float *m = marker.Row(c, y - y0 + yReach) + xReach;
+      for (int i = iMin; i < iMax; i++) {
+        const float d = f[i] - m[i];
+        sum += d * d;
+      }
+      sum += outside;
+    }
+    if (sum > bound) return sum;
+  }
+  return sum;
+}
+
+
+
+float R2PlanarImage::
+calculateSSD(const int x0, const int y0, const int x1, const int y1, const R2PlanarImage& otherImage, const int ssdSearchRadius, const int *rowOrder, const float bound) const
+{
+  // calculateSSD(x0, y0, x1, y1, otherImage, ssdSearchRadius) one window row at a
+  // time in rowOrder, giving up once the sum exceeds bound
+  const int colorChannels = std::min((nchannels < 3) ? nchannels : 3, otherImage.NChannels());
+  float sum = 0;
+  for (int k = 0; k < 2 * ssdSearchRadius + 1; k++) {
+    const int j = rowOrder[k];
+    for (int c = 0; c < colorChannels; c++) {
+      for (int i = -ssdSearchRadius; i < ssdSearchRadius + 1; i++) {
+        if (inBounds(x0 + i, y0 + j) && otherImage.inBounds(x1 + i, y1 + j)) {
+          const float d = Value(c, x0 + i, y0 + j) - otherImage.Value(c, x1 + i, y1 + j);
+          sum += d * d;
+        } else {
+          // account for out of bounds pixels by adding max possible ssd
+          sum += 1;
+        }
+      }
+    }
+    if (sum > bound) return sum;
+  }
+  return sum;
+}
+
+
+
+static bool
+MoreVarying(const std::pair<double, int>& a, const std::pair<double, int>& b)
+{
+  // Order (variance, row) pairs by decreasing variance
+  return a.first > b.first;
+}
+
+
+
+static void
+SortRowsByVariance(std::vector<std::pair<double, int> >& rows, int *rowOrder)
+{
+  // Row indices by decreasing variance (stable, so equal rows keep their order)
+  std::stable_sort(rows.begin(), rows.end(), MoreVarying);
+  for (size_t k = 0; k < rows.size(); k++) rowOrder[k] = rows[k].second;
+}
+
+
+
+void R2PlanarImage::
+calculateSSDRowOrder(int *rowOrder) const
+{
+  // Color rows of this marker by how much they vary: a flat row matches flat
+  // background about as well as the marker does, a busy one rarely does
+  const int colorChannels = (nchannels < 3) ? nchannels : 3;
+  std::vector<std::pair<double, int> > rows;
+  for (int c = 0; c < colorChannels; c++) {
+    for (int y = 0; y < height; y++) {
+      const float *row = Row(c, y);
+      double sum = 0, sumSquares = 0;
+      for (int x = 0; x < width; x++) {
+        sum += row[x];
+        sumSquares += (double) row[x] * row[x];
+      }
+      rows.push_back(std::make_pair(sumSquares - sum * sum / width, c * height + y));
+    }
+  }
+  SortRowsByVariance(rows, rowOrder);
+}
+
+
+
+void R2PlanarImage::
+calculateSSDRowOrder(const int x, const int y, const int ssdSearchRadius, int *rowOrder) const
+{
+  // Rows of the window at (x, y) by how much they vary over all color channels,
+  // rows partly outside the image first since every pixel there adds the max
+  const int colorChannels = (nchannels < 3) ? nchannels : 3;
+  const int n = 2 * ssdSearchRadius + 1;
+  std::vector<std::pair<double, int> > rows;
+  for (int j = -ssdSearchRadius; j < ssdSearchRadius + 1; j++) {
+    double variance = 0;
+    if ((y + j < 0) || (y + j >= height) || (x - ssdSearchRadius < 0) || (x + ssdSearchRadius >= width)) {
+      variance = HUGE_VAL;
+    }
+    else {
+      for (int c = 0; c < colorChannels; c++) {
+        const float *row = Row(c, y + j) + x;
+        double sum = 0, sumSquares = 0;
+        for (int i = -ssdSearchRadius; i < ssdSearchRadius + 1; i++) {
+          sum += row[i];
+          sumSquares += (double) row[i] * row[i];
+        }
+        variance += sumSquares - sum * sum / n;
+      }
+    }
+    rows.push_back(std::make_pair(variance, j));
+  }
+  SortRowsByVariance(rows, rowOrder);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////
+// NCC
+////////////////////////////////////////////////////////////////////////
+
+void R2PlanarImage::
+Standardize(void)
+{
+  // Every color channel to zero mean and unit variance (flat ones to zero)
+  const int colorChannels = (nchannels < 3) ? nchannels : 3;
+  const double n = (double) width * height;
+  for (int c = 0; c < colorChannels; c++) {
+    double sum = 0, sumSquares = 0;
+    for (int y = 0; y < height; y++) {
+      const float *row = Row(c, y);
+      for (int x = 0; x < width; x++) {
+        sum += row[x];
+        sumSquares += (double) row[x] * row[x];
+      }
+    }
+    const double mean = (n > 0) ? sum / n : 0;
+    const double variance = (n > 0) ? sumSquares / n - mean * mean : 0;
+    const float scale = (variance > R2_PLANAR_IMAGE_NCC_MIN_VARIANCE) ? 1 / sqrt(variance) : 0;
+    for (int y = 0; y < height; y++) {
+      float *row = Row(c, y);
+      for (int x = 0; x < width; x++) row[x] = (row[x] - mean) * scale;
+    }
+  }
+}
+
+
+
+float R2PlanarImage::
+calculateNCC(const int x0, const int y0, const R2PlanarImage& marker, const R2SummedAreaTable& table, const int *rowOrder, const float bound) const
+{
+  // Window centered at (x0, y0) standardized by its mean and variance over the
+  // part inside the image, against the marker one marker row at a time in
+  // rowOrder, giving up once the sum exceeds bound. Pixels outside the image, and
+  // all of a flat window, add m^2 + 1 like unit noise the marker does not
+  // correlate with (counting them as the window mean would favor windows that
+  // are mostly outside the image).
+  const int xReach = marker.Width() / 2;
+  const int yReach = marker.Height() / 2;
+  const int xEnd = marker.Width() - xReach;
+  const int yEnd = marker.Height() - yReach;
+  const int colorChannels = (nchannels < 3) ? nchannels : 3;
+  const int markerChannels = (marker.NChannels() < 3) ? marker.NChannels() : 3;
+
+  // Window columns and rows over the image
+  const int iMin = std::max(-xReach, -x0);
+  const int iMax = std::min(xEnd, width - x0);
+  const int jMin = std::max(-yReach, -y0);
+  const int jMax = std::min(yEnd, height - y0);
+  const int n = ((iMax > iMin) && (jMax > jMin)) ? (iMax - iMin) * (jMax - jMin) : 0;
+
+  // Mean and scale of the window per channel, in O(1) from the table
+  float means[3] = { 0, 0, 0 };
+  float scales[3] = { 0, 0, 0 };
+  float flats[3] = { 1, 1, 1 };
+  for (int c = 0; (c < colorChannels) && (n > 0); c++) {
+    const double mean = table.Sum(c, x0 + iMin, y0 + jMin, x0 + iMax, y0 + jMax) / n;
+    const double variance = table.SumOfSquares(c, x0 + iMin, y0 + jMin, x0 + iMax, y0 + jMax) / n - mean * mean;
+    means[c] = mean;
+    scales[c] = (variance > R2_PLANAR_IMAGE_NCC_MIN_VARIANCE) ? 1 / sqrt(variance) : 0;
+    flats[c] = (scales[c] > 0) ? 0 : 1;
+  }
+
+  float sum = 0;
+  for (int k = 0; k < markerChannels * marker.Height(); k++) {
+    const int c = rowOrder[k] / marker.Height();
+    const int y = y0 + rowOrder[k] % marker.Height() - yReach;
+    if (c >= colorChannels) continue;
+    const float *m = marker.Row(c, y - y0 + yReach) + xReach;
+    if ((y < 0) || (y >= height) || (iMax <= iMin)) {
+      for (int i = -xReach; i < xEnd; i++) sum += m[i] * m[i] + 1;
+    }
+    else {
+      const float *f = Row(c, y) + x0;
+      const float mean = means[c];
+      const float scale = scales[c];
+      for (int i = iMin; i < iMax; i++) {
+        const float d = (f[i] - mean) * scale - m[i];
+        sum += d * d;
+      }
+      for (int i = -xReach; i < iMin; i++) sum += m[i] * m[i] + 1;
+      for (int i = iMax; i < xEnd; i++) sum += m[i] * m[i] + 1;
+      sum += flats[c] * (iMax - iMin);
+    }
+    if (sum > bound) return sum;
+  }
+  return sum;
+}
+
+
+
+void R2PlanarImage::
+calculateNCCSurface(const int xMin, const int yMin, const int xMax, const int yMax, const R2PlanarImage& marker, const R2SummedAreaTable& table, float *costs) const
+{
+  // calculateNCC(x, y, marker, table) for every (x, y) of the box, row by row into
+  // costs. With the window standardized by mean u and scale s over its pixels
+  // inside the image, the cost is pixels - 2 s (sum(f m) - u sum(m)) + sum(m^2)
+  // (no cross term for a flat window): the cross term of all windows comes from
+  // one FFT correlation, the rest from summed area tables.
+  const int w = xMax - xMin;
+  const int h = yMax - yMin;
+  if ((w <= 0) || (h <= 0)) return;
+  const int mw = marker.Width();
+  const int mh = marker.Height();
+  const int xReach = mw / 2;
+  const int yReach = mh / 2;
+  const int colorChannels = (nchannels < 3) ? nchannels : 3;
+  const R2SummedAreaTable markerTable(marker);
+
+  // Image area the windows cover (zero outside the image), and the transform size
+  const int sx0 = xMin - xReach;
+  const int sy0 = yMin - yReach;
+  const int sw = w + mw - 1;
+  const int sh = h + mh - 1;
+  const int fw = R2FFTSize(sw);
+  const int fh = R2FFTSize(sh);
+  std::vector<std::complex<double> > covered((size_t) fw * fh), kernel((size_t) fw * fh);
+  std::vector<double> sums((size_t) w * h, 0.0);
+
+  for (int c = 0; c < colorChannels; c++) {
+    // Cross correlation: covered (*) conj(marker) in the frequency domain
+    std::fill(covered.begin(), covered.end(), std::complex<double>(0, 0));
+    for (int j = 0; j < sh; j++) {
+      for (int i = 0; i < sw; i++) {
+        if (inBounds(sx0 + i, sy0 + j)) covered[(size_t) j * fw + i] = Value(c, sx0 + i, sy0 + j);
+      }
+    }
+    std::fill(kernel.begin(), kernel.end(), std::complex<double>(0, 0));
+    for (int j = 0; j < mh; j++) {
+      for (int i = 0; i < mw; i++) kernel[(size_t) j * fw + i] = marker.Value(c, i, j);
+    }
+    R2FFT2D(covered.data(), fw, fh, false);
+    R2FFT2D(kernel.data(), fw, fh, false);
+    for (size_t k = 0; k < covered.size(); k++) covered[k] *= std::conj(kernel[k]);
+    R2FFT2D(covered.data(), fw, fh, true);
+
+    // Combine per window (u, v is the window corner in the covered area)
+    const double mm = markerTable.SumOfSquares(c, 0, 0, mw, mh);
+    for (int v = 0; v < h; v++) {
+      for (int u = 0; u < w; u++) {
+        // Window rows/columns inside the image, in marker coordinates
+        const int i0 = std::max(0, -(sx0 + u));
+        const int j0 = std::max(0, -(sy0 + v));
+        const int i1 = std::min(mw, width - (sx0 + u));
+        const int j1 = std::min(mh, height - (sy0 + v));
+        double sum = mm + (double) mw * mh;
+        if ((i1 > i0) && (j1 > j0)) {
+          const int n = (i1 - i0) * (j1 - j0);
+          const double mean = table.Sum(c, sx0 + u + i0, sy0 + v + j0, sx0 + u + i1, sy0 + v + j1) / n;
+          const double variance = table.SumOfSquares(c, sx0 + u + i0, sy0 + v + j0, sx0 + u + i1, sy0 + v + j1) / n - mean * mean;
+          if (variance > R2_PLANAR_IMAGE_NCC_MIN_VARIANCE) {
+            const double fm = covered[(size_t) v * fw + u].real();
+            const double m = markerTable.Sum(c, i0, j0, i1, j1);
+            sum -= 2 * (fm - mean * m) / sqrt(variance);
+          }
+        }
+        sums[(size_t) v * w + u] += sum;
+      }
+    }
+  }
+
+  for (size_t k = 0; k < sums.size(); k++) costs[k] = (float) std::max(sums[k], 0.0);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Luminance image
+////////////////////////////////////////////////////////////////////////
+
+R2LuminanceImage::
+R2LuminanceImage(void)
+  : R2PlanarImage()
+{
+}
+
+
+
+R2LuminanceImage::
+R2LuminanceImage(const R2Image& image)
+  : R2PlanarImage()
+{
+  // Convert the whole image (the view is only read)
+  FromLuminance(image.View());
+}
+
+
+
+R2LuminanceImage::
+R2LuminanceImage(const R2ImageView& view)
+  : R2PlanarImage()
+{
+  // Convert pixels under the view
+  FromLuminance(view);
+}
@@ -0,0 +1,234 @@
+// Include file for planar float image class
+#ifndef R2_PLANAR_IMAGE_INCLUDED
+#define R2_PLANAR_IMAGE_INCLUDED
+
+
+
+// Constant definitions
+
+// Every row (and therefore every plane) starts on a 64-byte boundary
+// (must divide R2_BUFFER_POOL_ALIGNMENT, planes come from R2BufferPool)
+#define R2_PLANAR_IMAGE_ALIGNMENT 64
+#define R2_PLANAR_IMAGE_ROW_ALIGNMENT (R2_PLANAR_IMAGE_ALIGNMENT / (int) sizeof(float))
+
+// Windows varying less than this are flat: NCC standardizes them to all zero
+// (the same as a window that does not correlate)
+#define R2_PLANAR_IMAGE_NCC_MIN_VARIANCE 1e-8
+
+
+
+// Class definition
+
+class R2Image;
+class R2ImageView;
+class R2Pixel;
+class R2SummedAreaTable;
+
+class R2PlanarImage {
+ public:
+  // Constructors/destructor
+  R2PlanarImage(void);
+  R2PlanarImage(int width, int height, int nchannels = 4);
+  R2PlanarImage(const R2Image& image);
+  R2PlanarImage(const R2ImageView& view);
+  R2PlanarImage(const R2PlanarImage& image);
+  R2PlanarImage(R2PlanarImage&& image) noexcept;
+  ~R2PlanarImage(void);
+
+  // Image properties
+  int Width(void) const;
+  int Height(void) const;
+  int NChannels(void) const;
+  int Stride(void) const;
+
+  // Plane access/update
+  // (planes are row-major, rows start at the bottom and are Stride() floats apart)
+  float *Plane(int channel);
+  const float *Plane(int channel) const;
+  float *Row(int channel, int y);
+  const float *Row(int channel, int y) const;
+  float& Value(int channel, int x, int y);
+  float Value(int channel, int x, int y) const;
+
+  // Compatibility pixel access
+  R2Pixel Pixel(int x, int y) const;
+  void SetPixel(int x, int y, const R2Pixel& pixel);
+
+  // Conversion
+  R2PlanarImage& operator=(const R2PlanarImage& image);
+  R2PlanarImage& operator=(R2PlanarImage&& image) noexcept;
+  void swap(R2PlanarImage& image) noexcept;
+  void FromImage(const R2Image& image);
+  void FromImage(const R2ImageView& view);
+  void FromLuminance(const R2ImageView& view);
+  void ToImage(R2Image& image) const;
+  void ToImage(const R2ImageView& view) const;
+
+  // Linear filtering operations
+  void applyFilter3x3(int filter[3][3]);
+  void SobelX(void);
+  void SobelY(void);
+  void Blur(double sigma, bool clamped);
+  void Harris(double sigma, bool clamped);
+
+  // Harris in steps, for smoothing the structure tensor more than once
+  void StructureTensor(R2PlanarImage& tensor) const;
+  void HarrisFromTensor(const R2PlanarImage& tensor, bool clamped);
+  void Downsample(R2PlanarImage& half) const;
+
+  // ssd
+  float calculateSSD(const int x0, const int y0, const R2PlanarImage& marker) const;
+  void calculateSSDSurface(const int xMin, const int yMin, const int xMax, const int yMax, const R2PlanarImage& marker, float *ssds) const;
+  float calculateSSD(const int x0, const int y0, const int x1, const int y1, const R2PlanarImage& otherImage, const int ssdSearchRadius) const;
+
+  // Bounded ssd: rows are summed in rowOrder and the partial sum is returned as soon
+  // as it exceeds bound (anything above bound is only a lower bound on the ssd).
+  // calculateSSDRowOrder fills rowOrder with the rows of this marker (channel * height + y,
+  // Height() per color channel), or of the window at (x, y) (offsets from y,
+  // 2 * ssdSearchRadius + 1 of them), most varying first so mismatches show up early.
+  float calculateSSD(const int x0, const int y0, const R2PlanarImage& marker, const int *rowOrder, const float bound) const;
+  float calculateSSD(const int x0, const int y0, const int x1, const int y1, const R2PlanarImage& otherImage, const int ssdSearchRadius, const int *rowOrder, const float bound) const;
+  void calculateSSDRowOrder(int *rowOrder) const;
+  void calculateSSDRowOrder(const int x, const int y, const int ssdSearchRadius, int *rowOrder) const;
+
+  // Zero mean normalized cross-correlation, as the ssd between the marker and the
+  // window each scaled to zero mean and unit variance: 2 * pixels * (1 - zncc) per
+  // channel, so brightness and contrast changes do not count. The marker must be
+  // Standardize()d, the window mean and variance come from table (summed over this
+  // image), and pixels outside the image count as noise the marker does not
+  // correlate with.
+  void Standardize(void);
+  float calculateNCC(const int x0, const int y0, const R2PlanarImage& marker, const R2SummedAreaTable& table, const int *rowOrder, const float bound) const;
+  void calculateNCCSurface(const int xMin, const int yMin, const int xMax, const int yMax, const R2PlanarImage& marker, const R2SummedAreaTable& table, float *costs) const;
+
+  // helpers
+  bool inBounds(const int x, const int y) const;
+
+ private:
+  // Utility functions
+  void Resize(int width, int height, int nchannels);
+
+ private:
+  float *data;
+  int nchannels;
+  int width;
+  int height;
+  int stride;
+};
+
+
+
+// Single plane of R2Pixel::Luminance() values. Detection and matching work on
+// this instead of three color planes, the filters and ssd above apply as is.
+class R2LuminanceImage : public R2PlanarImage {
+ public:
+  // Constructors
+  R2LuminanceImage(void);
+  R2LuminanceImage(const R2Image& image);
+  R2LuminanceImage(const R2ImageView& view);
+};
+
+
+
+// Inline functions
+
+inline int R2PlanarImage::
+Width(void) const
+{
+  // Return width
+  return width;
+}
+
+
+
+inline int R2PlanarImage::
+Height(void) const
+{
+  // Return height
+  return height;
+}
+
+
+
+inline int R2PlanarImage::
+NChannels(void) const
+{
+  // Return number of planes
+  return nchannels;
+}
+
+
+
+inline int R2PlanarImage::
+Stride(void) const
+{
+  // Return number of floats between the starts of consecutive rows
+  return stride;
+}
+
+
+
+inline float *R2PlanarImage::
+Plane(int channel)
+{
+  // Return pointer to first value of plane
+  return &data[channel * stride * height];
+}
+
+
+
+inline const float *R2PlanarImage::
+Plane(int channel) const
+{
+  // Return pointer to first value of plane
+  return &data[channel * stride * height];
+}
+
+
+
+inline float *R2PlanarImage::
+Row(int channel, int y)
+{
+  // Return pointer to row y of plane
+  return &data[(channel * height + y) * stride];
+}
+
+
+
+inline const float *R2PlanarImage::
+Row(int channel, int y) const
+{
+  // Return pointer to row y of plane
+  return &data[(channel * height + y) * stride];
+}
+
+
+
+inline float& R2PlanarImage::
+Value(int channel, int x, int y)
+{
+  // Return value of one channel at (x,y)
+  return data[(channel * height + y) * stride + x];
+}
+
+
+
+inline float R2PlanarImage::
+Value(int channel, int x, int y) const
+{
+  // Return value of one channel at (x,y)
+  return data[(channel * height + y) * stride + x];
+}
+
+
+
+inline bool R2PlanarImage::
+inBounds(const int x, const int y) const
+{
+  // Return whether (x,y) is inside the image
+  return (x >= 0) && (x < width) && (y >= 0) && (y < height);
+}
+
+
+
+#endif
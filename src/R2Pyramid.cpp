@@ -0,0 +1,157 @@
+// Source file for Gaussian pyramid class
+
+
+
+// Include files
+
+#include <stdio.h>
+#include <assert.h>
+#include <cmath>
+#include <utility>
+#include <vector>
+#include <algorithm>
+#include "R2Pixel.h"
+#include "R2Image.h"
+#include "R2ImageView.h"
+#include "R2PlanarImage.h"
+#include "R2Pyramid.h"
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Constructors
+////////////////////////////////////////////////////////////////////////
+
+R2Pyramid::
+R2Pyramid(void)
+{
+}
+
+
+
+R2Pyramid::
+R2Pyramid(const R2ImageView& view, int nlevels)
+{
+  // Build levels from the pixels under the view
+  Build(view, nlevels);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Construction
+////////////////////////////////////////////////////////////////////////
+
+void R2Pyramid::
+Build(const R2ImageView& view, int nlevels)
+{
+  // Full size luminance, then the coarser levels
+  levels.clear();
+  levels.reserve(nlevels);
+  levels.push_back(R2LuminanceImage(view));
+  Extend(nlevels);
+}
+
+
+
+void R2Pyramid::
+Extend(int nlevels)
+{
+  // Blur and decimate the coarsest level until there are nlevels
+  assert(!levels.empty());
+  while ((int) levels.size() < nlevels) {
+    const R2LuminanceImage& coarsest = levels.back();
+    if ((coarsest.Width() < 2) || (coarsest.Height() < 2)) break;
+    R2LuminanceImage blurred(coarsest);
+    blurred.Blur(R2_PYRAMID_SIGMA, false);
+    R2LuminanceImage half;
+    blurred.Downsample(half);
+    levels.push_back(std::move(half));
+  }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Tracking
+////////////////////////////////////////////////////////////////////////
+
+bool R2Pyramid::
+Track(const R2Pyramid& templ, int coarsest, double& x, double& y) const
+{
+  // Forward additive Lucas-Kanade for a translation: every step samples the image
+  // under the template (bilinearly) and solves the 2x2 Gauss-Newton system of its
+  // gradients, so it settles where the ssd itself is least even when the template
+  // only roughly looks like the image. Fails when the finest level does not settle.
+  coarsest = std::min(coarsest, std::min(NLevels(), templ.NLevels()) - 1);
+  if (coarsest < 0) return false;
+  double px = ldexp(x, -coarsest);
+  double py = ldexp(y, -coarsest);
+  bool converged = false;
+  for (int level = coarsest; level >= 0; level--) {
+    const R2LuminanceImage& image = levels[level];
+    const R2LuminanceImage& t = templ.Level(level);
+    const int tw = t.Width();
+    const int th = t.Height();
+    if ((tw < 3) || (th < 3)) return false;
+    std::vector<float> warped(tw * th);
+
+    converged = false;
+    for (int iteration = 0; (iteration < R2_PYRAMID_TRACK_ITERATIONS) && !converged; iteration++) {
+      // Template has to stay where it can be interpolated
+      if ((px < 0) || (py < 0) || (px + tw >= image.Width()) || (py + th >= image.Height())) return false;
+      const int ix = (int) px;
+      const int iy = (int) py;
+      const float fx = (float) (px - ix);
+      const float fy = (float) (py - iy);
+      for (int j = 0; j < th; j++) {
+        const float *r0 = image.Row(0, iy + j) + ix;
+        const float *r1 = image.Row(0, iy + j + 1) + ix;
+        float *w = &warped[j * tw];
+        for (int i = 0; i < tw; i++) {
+          const float lower = r0[i] + fx * (r0[i + 1] - r0[i]);
+          const float upper = r1[i] + fx * (r1[i + 1] - r1[i]);
+          w[i] = lower + fy * (upper - lower);
+        }
+      }
+
+      // Residuals projected on the gradients of the sampled image (central
+      // differences, inner pixels only)
+      double hxx = 0, hxy = 0, hyy = 0, bx = 0, by = 0;
+      for (int j = 1; j < th - 1; j++) {
+        const float *w = &warped[j * tw];
+        const float *m = t.Row(0, j);
+        for (int i = 1; i < tw - 1; i++) {
+          const double gx = 0.5 * (w[i + 1] - w[i - 1]);
+          const double gy = 0.5 * (w[i + tw] - w[i - tw]);
+          const double e = w[i] - m[i];
+          hxx += gx * gx;
+          hxy += gx * gy;
+          hyy += gy * gy;
+          bx += gx * e;
+          by += gy * e;
+        }
+      }
+      const double det = hxx * hyy - hxy * hxy;
+      if (det <= 1e-12 * (hxx + hyy) * (hxx + hyy)) return false;
+
+      // Solve the 2x2 system for the step
+      const double dx = (hyy * bx - hxy * by) / det;
+      const double dy = (hxx * by - hxy * bx) / det;
+      px -= dx;
+      py -= dy;
+      converged = dx * dx + dy * dy < R2_PYRAMID_TRACK_EPSILON * R2_PYRAMID_TRACK_EPSILON;
+    }
+
+    // Next level samples twice as densely
+    if (level > 0) {
+      px *= 2;
+      py *= 2;
+    }
+  }
+  if (!converged) return false;
+
+  x = px;
+  y = py;
+  return true;
+}
@@ -0,0 +1,83 @@
+// Include file for Gaussian pyramid class
+#ifndef R2_PYRAMID_INCLUDED
+#define R2_PYRAMID_INCLUDED
+
+
+
+// Include files
+
+#include <vector>
+#include "R2PlanarImage.h"
+
+
+
+// Constant definitions
+
+// Levels built when none are asked for
+#define R2_PYRAMID_DEFAULT_LEVELS 4
+
+// Blur applied before each 2x decimation (in pixels of the finer level)
+#define R2_PYRAMID_SIGMA 1.0
+
+// Lucas-Kanade tracking: Gauss-Newton steps per level, and the step (in pixels
+// of the level) below which a level has converged
+#define R2_PYRAMID_TRACK_ITERATIONS 10
+#define R2_PYRAMID_TRACK_EPSILON 0.05
+
+
+
+// Class definition
+
+class R2ImageView;
+
+// Gaussian pyramid of luminance. Level 0 is the image at full size, and level
+// k + 1 is level k blurred with R2_PYRAMID_SIGMA and decimated by 2, so pixel
+// (x, y) of level k samples (x << k, y << k) of level 0. Levels stop early
+// once another halving would leave less than a pixel.
+class R2Pyramid {
+ public:
+  // Constructors
+  R2Pyramid(void);
+  R2Pyramid(const R2ImageView& view, int nlevels = R2_PYRAMID_DEFAULT_LEVELS);
+
+  // Pyramid properties
+  int NLevels(void) const;
+  const R2LuminanceImage& Level(int level) const;
+
+  // Construction (Extend adds coarser levels to an existing pyramid)
+  void Build(const R2ImageView& view, int nlevels = R2_PYRAMID_DEFAULT_LEVELS);
+  void Extend(int nlevels);
+
+  // Lucas-Kanade tracking of a template pyramid from level coarsest down to 0.
+  // (x, y) is where the bottom left corner of the template is in level 0, and is
+  // moved to where it fits best. Returns false when the template leaves the
+  // pyramid, has no texture to track by or does not settle.
+  bool Track(const R2Pyramid& templ, int coarsest, double& x, double& y) const;
+
+ private:
+  std::vector<R2LuminanceImage> levels;
+};
+
+
+
+// Inline functions
+
+inline int R2Pyramid::
+NLevels(void) const
+{
+  // Return number of levels
+  return (int) levels.size();
+}
+
+
+
+inline const R2LuminanceImage& R2Pyramid::
+Level(int level) const
+{
+  // Return luminance of level (0 is full size)
+  return levels[level];
+}
+
+
+
+#endif
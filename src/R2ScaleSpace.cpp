@@ -0,0 +1,78 @@
+// Source file for Harris scale space class
+
+
+
+// Include files
+
+#include <stdio.h>
+#include <assert.h>
+#include <cmath>
+#include "R2Pixel.h"
+#include "R2Image.h"
+#include "R2ImageView.h"
+#include "R2PlanarImage.h"
+#include "R2ScaleSpace.h"
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Constructor
+////////////////////////////////////////////////////////////////////////
+
+R2HarrisScaleSpace::
+R2HarrisScaleSpace(const R2ImageView& view, double firstSigma, double sigmaStep, int nlevels, bool octaves)
+  : responses(nlevels),
+    sigmas(nlevels),
+    factors(nlevels)
+{
+  // Structure tensor of the luminance, once for all levels
+  R2LuminanceImage luminance(view);
+  R2PlanarImage tensor;
+  luminance.StructureTensor(tensor);
+
+  // Blur the tensor up to each sigma in turn (blurred is its sigma so far, in view pixels)
+  double blurred = 0;
+  int factor = 1;
+  for (int level = 0; level < nlevels; level++) {
+    const double sigma = firstSigma + level * sigmaStep;
+
+    // Halve resolution once the tensor is smooth enough for it
+    if (octaves && (blurred / factor >= R2_SCALE_SPACE_OCTAVE_SIGMA) && (tensor.Width() > 1) && (tensor.Height() > 1)) {
+      R2PlanarImage half;
+      tensor.Downsample(half);
+      tensor.swap(half);
+      factor *= 2;
+    }
+
+    // Gaussians compose by adding variances
+    if (sigma > blurred) {
+      tensor.Blur(sqrt(sigma * sigma - blurred * blurred) / factor, false);
+      blurred = sigma;
+    }
+
+    responses[level].HarrisFromTensor(tensor, false);
+    sigmas[level] = blurred;
+    factors[level] = factor;
+  }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Responses
+////////////////////////////////////////////////////////////////////////
+
+float R2HarrisScaleSpace::
+Response(int level, int x, int y) const
+{
+  // Nearest sample of the level, clamped to its extent
+  const R2PlanarImage& plane = responses[level];
+  const int factor = factors[level];
+  int i = (x + factor / 2) / factor;
+  int j = (y + factor / 2) / factor;
+  if (i > plane.Width() - 1) i = plane.Width() - 1;
+  if (j > plane.Height() - 1) j = plane.Height() - 1;
+  if (i < 0) i = 0;
+  if (j < 0) j = 0;
+  return plane.Value(0, i, j);
+}
@@ -0,0 +1,90 @@
+// Include file for Harris scale space class
+#ifndef R2_SCALE_SPACE_INCLUDED
+#define R2_SCALE_SPACE_INCLUDED
+
+
+
+// Include files
+
+#include <vector>
+#include "R2PlanarImage.h"
+
+
+
+// Constant definitions
+
+// With octaves on, the structure tensor is halved in size once it has been
+// smoothed by this many of its own pixels
+#define R2_SCALE_SPACE_OCTAVE_SIGMA 4.0
+
+
+
+// Class definition
+
+class R2ImageView;
+
+// Harris responses of a view for sigmas firstSigma, firstSigma + sigmaStep, ...
+// The structure tensor is computed once and each level blurs it further from
+// the previous one by sqrt(sigma^2 - previousSigma^2), optionally halving its
+// resolution along the way. Responses are kept for every level.
+class R2HarrisScaleSpace {
+ public:
+  // Constructor
+  R2HarrisScaleSpace(const R2ImageView& view, double firstSigma, double sigmaStep, int nlevels, bool octaves = false);
+
+  // Level properties
+  int NLevels(void) const;
+  double Sigma(int level) const;
+  int Factor(int level) const;
+  const R2PlanarImage& Responses(int level) const;
+
+  // Response at (x, y) in view pixels, from the nearest sample of the level
+  float Response(int level, int x, int y) const;
+
+ private:
+  std::vector<R2PlanarImage> responses;
+  std::vector<double> sigmas;
+  std::vector<int> factors;
+};
+
+
+
+// Inline functions
+
+inline int R2HarrisScaleSpace::
+NLevels(void) const
+{
+  // Return number of levels
+  return (int) responses.size();
+}
+
+
+
+inline double R2HarrisScaleSpace::
+Sigma(int level) const
+{
+  // Return sigma of level, in view pixels
+  return sigmas[level];
+}
+
+
+
+inline int R2HarrisScaleSpace::
+Factor(int level) const
+{
+  // Return how many view pixels one response sample of level covers
+  return factors[level];
+}
+
+
+
+inline const R2PlanarImage& R2HarrisScaleSpace::
+Responses(int level) const
+{
+  // Return response plane of level
+  return responses[level];
+}
+
+
+
+#endif
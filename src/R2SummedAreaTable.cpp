@@ -0,0 +1,70 @@
+// Source file for summed area table class
+
+
+
+// Include files
+
+#include <stdio.h>
+#include <assert.h>
+#include <vector>
+#include "R2PlanarImage.h"
+#include "R2SummedAreaTable.h"
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Constructors
+////////////////////////////////////////////////////////////////////////
+
+R2SummedAreaTable::
+R2SummedAreaTable(void)
+  : nchannels(0),
+    width(0),
+    height(0)
+{
+}
+
+
+
+R2SummedAreaTable::
+R2SummedAreaTable(const R2PlanarImage& image)
+  : nchannels(0),
+    width(0),
+    height(0)
+{
+  // Sum the image
+  Build(image);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Construction
+////////////////////////////////////////////////////////////////////////
+
+void R2SummedAreaTable::
+Build(const R2PlanarImage& image)
+{
+  // One (width + 1) x (height + 1) table of sums and one of squares per color
+  // channel, each entry the one below plus the running sum of its row
+  width = image.Width();
+  height = image.Height();
+  nchannels = (image.NChannels() < 3) ? image.NChannels() : 3;
+  const size_t size = (size_t) (width + 1) * (height + 1);
+  sums.assign(nchannels * size, 0.0);
+  squares.assign(nchannels * size, 0.0);
+  for (int c = 0; c < nchannels; c++) {
+    double *s = &sums[c * size];
+    double *q = &squares[c * size];
+    for (int y = 0; y < height; y++) {
+      const float *row = image.Row(c, y);
+      double rowSum = 0, rowSquares = 0;
+      for (int x = 0; x < width; x++) {
+        rowSum += row[x];
+        rowSquares += (double) row[x] * row[x];
+        s[(y + 1) * (width + 1) + x + 1] = s[y * (width + 1) + x + 1] + rowSum;
+        q[(y + 1) * (width + 1) + x + 1] = q[y * (width + 1) + x + 1] + rowSquares;
+      }
+    }
+  }
+}
@@ -0,0 +1,113 @@
+// Include file for summed area table class
+#ifndef R2_SUMMED_AREA_TABLE_INCLUDED
+#define R2_SUMMED_AREA_TABLE_INCLUDED
+
+
+
+// Include files
+
+#include <vector>
+
+
+
+// Class definition
+
+class R2PlanarImage;
+
+// Running sums of the values and of their squares over the color channels of a
+// planar image, so the sum, mean or variance of any box comes in O(1). Sums are
+// kept in doubles, floats lose the variance of a large image.
+class R2SummedAreaTable {
+ public:
+  // Constructors
+  R2SummedAreaTable(void);
+  R2SummedAreaTable(const R2PlanarImage& image);
+
+  // Table properties
+  int Width(void) const;
+  int Height(void) const;
+  int NChannels(void) const;
+
+  // Construction
+  void Build(const R2PlanarImage& image);
+
+  // Sums over the pixels of [x0, x1) x [y0, y1) (boxes are clipped to the image)
+  double Sum(int channel, int x0, int y0, int x1, int y1) const;
+  double SumOfSquares(int channel, int x0, int y0, int x1, int y1) const;
+
+ private:
+  double BoxSum(const std::vector<double>& table, int channel, int x0, int y0, int x1, int y1) const;
+
+ private:
+  std::vector<double> sums;
+  std::vector<double> squares;
+  int nchannels;
+  int width;
+  int height;
+};
+
+
+
+// Inline functions
+
+inline int R2SummedAreaTable::
+Width(void) const
+{
+  // Return width of the image summed
+  return width;
+}
+
+
+
+inline int R2SummedAreaTable::
+Height(void) const
+{
+  // Return height of the image summed
+  return height;
+}
+
+
+
+inline int R2SummedAreaTable::
+NChannels(void) const
+{
+  // Return number of channels summed
+  return nchannels;
+}
+
+
+
+inline double R2SummedAreaTable::
+Sum(int channel, int x0, int y0, int x1, int y1) const
+{
+  // Return sum of the values in the box
+  return BoxSum(sums, channel, x0, y0, x1, y1);
+}
+
+
+
+inline double R2SummedAreaTable::
+SumOfSquares(int channel, int x0, int y0, int x1, int y1) const
+{
+  // Return sum of the squared values in the box
+  return BoxSum(squares, channel, x0, y0, x1, y1);
+}
+
+
+
+inline double R2SummedAreaTable::
+BoxSum(const std::vector<double>& table, int channel, int x0, int y0, int x1, int y1) const
+{
+  // Four corners of the clipped box (entry (x, y) sums the pixels below and left of it)
+  x0 = (x0 < 0) ? 0 : ((x0 > width) ? width : x0);
+  x1 = (x1 < 0) ? 0 : ((x1 > width) ? width : x1);
+  y0 = (y0 < 0) ? 0 : ((y0 > height) ? height : y0);
+  y1 = (y1 < 0) ? 0 : ((y1 > height) ? height : y1);
+  if ((x1 <= x0) || (y1 <= y0)) return 0;
+  const double *t = &table[(size_t) channel * (width + 1) * (height + 1)];
+  return t[y1 * (width + 1) + x1] - t[y0 * (width + 1) + x1] - t[y1 * (width + 1) + x0] + t[y0 * (width + 1) + x0];
+}
+
+
+
+#endif
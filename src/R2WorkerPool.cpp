@@ -0,0 +1,144 @@
+// Source file for persistent worker thread pool class
+
+
+
+// Include files
+
+#include <stdio.h>
+#include <assert.h>
+#include <algorithm>
+#include <system_error>
+#include "R2WorkerPool.h"
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Shared pool
+////////////////////////////////////////////////////////////////////////
+
+R2WorkerPool& R2WorkerPool::
+SharedPool(void)
+{
+  // One worker per hardware thread besides the caller (C++11 makes this thread safe)
+  static R2WorkerPool pool(std::min((int) std::thread::hardware_concurrency() - 1, R2_WORKER_POOL_MAX_THREADS));
+  return pool;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Constructors/destructor
+////////////////////////////////////////////////////////////////////////
+
+R2WorkerPool::
+R2WorkerPool(int nthreads)
+  : tasks(NULL),
+    ntasks(0),
+    nextTask(0),
+    nfinished(0),
+    generation(0),
+    stopping(false)
+{
+  // Start workers (none leaves Run to the calling thread alone)
+  for (int i = 0; i < nthreads; i++) {
+    try {
+      threads.push_back(std::thread(&R2WorkerPool::WorkerMain, this));
+    }
+    catch (const std::system_error&) {
+      fprintf(stderr, "Unable to start worker thread %d\n", i);
+      break;
+    }
+  }
+}
+
+
+
+R2WorkerPool::
+~R2WorkerPool(void)
+{
+  // Wake workers up to leave, and wait for them
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  workReady.notify_all();
+  for (size_t i = 0; i < threads.size(); i++) {
+    threads[i].join();
+  }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Running tasks
+////////////////////////////////////////////////////////////////////////
+
+void R2WorkerPool::
+Run(R2WorkerTask *runTasks, int nrunTasks)
+{
+  // Run here when there is nobody to share the tasks with
+  if (nrunTasks <= 0) return;
+  if (threads.empty() || (nrunTasks == 1)) {
+    for (int i = 0; i < nrunTasks; i++) runTasks[i].function(runTasks[i].data);
+    return;
+  }
+
+  // One batch at a time (tasks may come from several threads)
+  std::lock_guard<std::mutex> run(runMutex);
+
+  // Publish the batch and wake workers
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    tasks = runTasks;
+    ntasks = nrunTasks;
+    nextTask = 0;
+    nfinished = 0;
+    generation++;
+  }
+  workReady.notify_all();
+
+  // Work on the batch too, then wait for the tasks still running elsewhere
+  while (RunNextTask()) {}
+  std::unique_lock<std::mutex> lock(mutex);
+  while (nfinished < ntasks) workDone.wait(lock);
+  tasks = NULL;
+  ntasks = 0;
+}
+
+
+
+bool R2WorkerPool::
+RunNextTask(void)
+{
+  // Take the next task of the batch, if any, and run it
+  std::unique_lock<std::mutex> lock(mutex);
+  if (nextTask >= ntasks) return false;
+  R2WorkerTask task = tasks[nextTask++];
+  lock.unlock();
+
+  task.function(task.data);
+
+  // Tell Run once the last one is done
+  lock.lock();
+  if (++nfinished == ntasks) workDone.notify_one();
+  return true;
+}
+
+
+
+void R2WorkerPool::
+WorkerMain(void)
+{
+  // Wait for a new batch, help run it, repeat until the pool goes away
+  unsigned long seen = 0;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      while (!stopping && (generation == seen)) workReady.wait(lock);
+      if (stopping) return;
+      seen = generation;
+    }
+
+    while (RunNextTask()) {}
+  }
+}
@@ -0,0 +1,87 @@
+// Include file for persistent worker thread pool class
+#ifndef R2_WORKER_POOL_INCLUDED
+#define R2_WORKER_POOL_INCLUDED
+
+
+
+// Include files
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+
+
+// Constant definitions
+
+// Most worker threads the shared pool starts (the caller of Run makes one more)
+#define R2_WORKER_POOL_MAX_THREADS 15
+
+
+
+// Class definition
+
+// One task handed to R2WorkerPool::Run
+struct R2WorkerTask {
+  void (*function)(void *data);
+  void *data;
+};
+
+// Threads started once and kept waiting for work, so handing out a few tasks
+// per frame costs a wakeup instead of starting a thread. Run hands tasks out in
+// order to whichever thread is free (the calling thread included) and returns
+// once all of them are done. Tasks must not depend on one another or on the
+// order they run in, so results do not depend on the number of threads.
+class R2WorkerPool {
+ public:
+  // Pool shared by the whole program (started on first use)
+  static R2WorkerPool& SharedPool(void);
+
+  // Constructor/destructor
+  R2WorkerPool(int nthreads);
+  ~R2WorkerPool(void);
+
+  // Pool properties
+  int NThreads(void) const;
+
+  // Run all tasks and wait for them
+  void Run(R2WorkerTask *tasks, int ntasks);
+
+ private:
+  // Pools are not copied
+  R2WorkerPool(const R2WorkerPool& pool);
+  R2WorkerPool& operator=(const R2WorkerPool& pool);
+
+  // Utility functions
+  void WorkerMain(void);
+  bool RunNextTask(void);
+
+ private:
+  std::vector<std::thread> threads;
+  std::mutex mutex;
+  std::mutex runMutex;
+  std::condition_variable workReady;
+  std::condition_variable workDone;
+  R2WorkerTask *tasks;
+  int ntasks;
+  int nextTask;
+  int nfinished;
+  unsigned long generation;
+  bool stopping;
+};
+
+
+
+// Inline functions
+
+inline int R2WorkerPool::
+NThreads(void) const
+{
+  // Return number of worker threads (not counting the caller of Run)
+  return (int) threads.size();
+}
+
+
+
+#endif
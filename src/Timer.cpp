@@ -1,14 +1,15 @@
 #include <time.h>
+#include <chrono>
 
 class Timer {
 	private:
-		unsigned long begTime;
+		std::chrono::steady_clock::time_point begTime;
 	public:
         Timer(void) {
-            begTime = 0;
+            begTime = std::chrono::steady_clock::now();
         }
 		void start() {
-			begTime = clock();
+			begTime = std::chrono::steady_clock::now();
 		}
 
         void restart() {
@@ -16,7 +17,8 @@ class Timer {
         }
 
 		int elapsedTime() {
-			return (int)((((float) clock() - begTime) / (float)CLOCKS_PER_SEC) * 1000);
+			// Wall clock milliseconds (clock() would add up the time of all worker threads)
+			return (int) std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - begTime).count();
 		}
 
 		bool isTimeout(unsigned long seconds) {
@@ -28,9 +28,15 @@
 #include "R2/R2.h"
 #include "R2Pixel.h"
 #include "R2Image.h"
+#include "R2BufferPool.h"
+#include "R2Blur.h"
+#include "R2Fast.h"
+#include "R2PlanarImage.h"
+#include "R2WorkerPool.h"
 
 // Added for processing image sequences
 #include <string>
+#include <algorithm>
 #include <sys/stat.h>
 
 // Program arguments
@@ -38,6 +44,17 @@
 static char options[] =
 "  -help\n"
 "  -svdTest\n"
+"  -blurTest\n"
+"  -threads\n"
+"  -threadTest\n"
+"  -ncc\n"
+"  -scaleInvariant\n"
+"  -octaves\n"
+"  -anms\n"
+"  -featureTest\n"
+"  -brief\n"
+"  -verify\n"
+"  -matchTest\n"
 "  -sobelX\n"
 "  -sobelY\n"
 "  -log\n"
@@ -133,18 +150,21 @@ void importMarkerImages(std::vector<R2Image>& markerImages, char* marker_folder_
   std::vector<std::string> markerImageNames;
   grabImageNames(markerImageNames, marker_folder_name, marker_base_name);
 
-  // import marker images
+  // import marker images (moved into the vector, never copied)
+  markerImages.reserve(markerImages.size() + markerImageNames.size());
   for (size_t i = 0; i < markerImageNames.size(); ++i) {
     //printf(markerImageNames[i].c_str()); printf("\n");
-    R2Image *marker = new R2Image(markerImageNames[i].c_str());
-    verifyImageAllocation(marker);
-    markerImages.push_back(*marker);
+    markerImages.push_back(R2Image(markerImageNames[i].c_str()));
+    if (markerImages.back().NPixels() == 0) {
+      fprintf(stderr, "Unable to read marker image from %s\n", markerImageNames[i].c_str());
+      exit(-1);
+    }
   }
 
   assert(markerImages.size() == 4);
 }
 
-void harryPotterizeSequence(std::vector<std::string> &inputImageNames, std::vector<std::string> &outputImageNames, std::vector<std::string> &inputInnerImageNames, std::vector<R2Image> &markerImages, bool multithreaded) {
+void harryPotterizeSequence(std::vector<std::string> &inputImageNames, std::vector<std::string> &outputImageNames, std::vector<std::string> &inputInnerImageNames, std::vector<R2Image> &markerImages, bool multithreaded, bool normalized, std::vector<Point> *trackedCorners = NULL) {
   const float fps = 24;
   const float videoStartTime = 0 * fps;
   const float videoAnimateTime = 0.75 * fps;
@@ -159,42 +179,53 @@ void harryPotterizeSequence(std::vector<std::string> &inputImageNames, std::vect
       cornerCoords.push_back(Point(-1, -1));
   }
 
+  // motion of every marker, predicting where to search for it next
+  std::vector<MarkerTrack> markerTracks;
+
   // start overall timer
   Timer outerTimer;
   outerTimer.start();
   Timer innerTimer;
 
+  // frame buffers are allocated once and refilled every frame, and the pixel
+  // buffers behind them come back from the buffer pool at the same size
+  // (row-major so scanline I/O and the warp walk memory contiguously)
+  R2Image *imageFrame = new R2Image(0, 0, R2_IMAGE_ROW_MAJOR_LAYOUT);
+  verifyImageAllocation(imageFrame);
+  R2Image *innerFrame = new R2Image(0, 0, R2_IMAGE_ROW_MAJOR_LAYOUT);
+  verifyImageAllocation(innerFrame);
+  int innerFrameNum = -1;
 
 // iterate through image frames
   for (int i = 0; i < inputImageNames.size(); i++) {
     printf("%.2f%% Complete\n", 100 * float(i) / float(inputImageNames.size()));
 
-    // allocate image frame
-    R2Image *imageFrame = new R2Image(inputImageNames[i].c_str()); 
-    verifyImageAllocation(imageFrame);
+    // read image frame
+    if (!imageFrame->Read(inputImageNames[i].c_str())) {
+      fprintf(stderr, "Unable to read image from %s\n", inputImageNames[i].c_str());
+      exit(-1);
+    }
 
      if (i < videoStartTime) {
       writeImage(imageFrame, outputImageNames[i].c_str());
       continue;
     }
 
-    //allocate inner image
-    R2Image *innerFrame;
-    if (i < inputInnerImageNames.size() + videoAnimateTime) {
-      // always grab first frame if before videoAnimateTime
-      int frameNum = i - videoAnimateTime;
-      frameNum = fmax(0, frameNum);
-
-      innerFrame = new R2Image(inputInnerImageNames[frameNum].c_str());
-      verifyImageAllocation(innerFrame);
-
-    } else {
-      innerFrame = new R2Image(inputInnerImageNames[inputInnerImageNames.size() - 1].c_str());
-      verifyImageAllocation(innerFrame);
+    // read inner image (always grab first frame if before videoAnimateTime, last one after the inner sequence ends)
+    int frameNum = i - videoAnimateTime;
+    frameNum = fmax(0, frameNum);
+    frameNum = fmin(inputInnerImageNames.size() - 1, frameNum);
+    if (frameNum != innerFrameNum) {
+      if (!innerFrame->Read(inputInnerImageNames[frameNum].c_str())) {
+        fprintf(stderr, "Unable to read image from %s\n", inputInnerImageNames[frameNum].c_str());
+        exit(-1);
+      }
+      innerFrameNum = frameNum;
     }
 
-    // set threading mode
+    // set threading and matching modes
     imageFrame->setMultiThread(multithreaded);
+    imageFrame->setMarkerNCC(normalized);
 
     int numPreviousLocations = 0;
     for (int j = 0; j < cornerCoords.size(); j++) {
@@ -204,8 +235,9 @@ void harryPotterizeSequence(std::vector<std::string> &inputImageNames, std::vect
     if (debugMode) printf("Num Previous Locations: %d \n", numPreviousLocations);
     // Find trackers on image
     if (debugMode) innerTimer.start();
-    imageFrame->identifyCorners(markerImages, cornerCoords);
+    imageFrame->identifyCorners(markerImages, cornerCoords, markerTracks);
     if (debugMode) printf("Image %d corners found ...%d ms \n", i+1, innerTimer.elapsedTime());
+    if (trackedCorners) trackedCorners->insert(trackedCorners->end(), cornerCoords.begin(), cornerCoords.begin() + markerImages.size());
 
     // Warp in other image
     if (debugMode) innerTimer.start();
@@ -214,13 +246,203 @@ void harryPotterizeSequence(std::vector<std::string> &inputImageNames, std::vect
     
     // Write output image
     writeImage(imageFrame, outputImageNames[i].c_str());
-
-    // clean up memory
-    delete imageFrame;
   }
+
+  if (debugMode) imageFrame->printSSDStats(stdout);
+
+  // clean up memory
+  delete imageFrame;
+  delete innerFrame;
+  if (debugMode) R2BufferPool::ThreadPool().PrintStats(stdout);
   if (debugMode) printf("Sequence done! %lu frames %d seconds\n\n", inputImageNames.size(), outerTimer.elapsedTime() / 1000);
 }
 
+void runHarryPotterizeSequence(std::vector<std::string> &inputImageNames, std::vector<std::string> &outputImageNames, std::vector<std::string> &inputInnerImageNames, std::vector<R2Image> &markerImages, bool multithreaded, bool normalized, bool testThreadSpeeds) {
+  if (!testThreadSpeeds) {
+    // do the magic
+    harryPotterizeSequence(inputImageNames, outputImageNames, inputInnerImageNames, markerImages, multithreaded, normalized);
+    return;
+  }
+
+  // Single thread test
+  std::vector<Point> singleCorners, multiCorners;
+  Timer timer;
+  printf("Single thread:\n");
+  timer.start();
+  harryPotterizeSequence(inputImageNames, outputImageNames, inputInnerImageNames, markerImages, false, normalized, &singleCorners);
+  const int singleTime = timer.elapsedTime();
+
+  // Multi thread test
+  printf("Multi thread (%d workers):\n", R2WorkerPool::SharedPool().NThreads());
+  timer.start();
+  harryPotterizeSequence(inputImageNames, outputImageNames, inputInnerImageNames, markerImages, true, normalized, &multiCorners);
+  const int multiTime = timer.elapsedTime();
+
+  // Both must track the same corners
+  int differences = 0;
+  for (size_t i = 0; i < singleCorners.size(); i++) {
+    if ((singleCorners[i].x != multiCorners[i].x) || (singleCorners[i].y != multiCorners[i].y)) differences++;
+  }
+  printf("Single thread %d ms, multi thread %d ms, %d of %lu tracked corners differ\n", singleTime, multiTime, differences, singleCorners.size());
+}
+
+int countRepeatedFeatures(const std::vector<Feature>& features, const std::vector<Feature>& nextFeatures) {
+  // Features found again in the next frame: within 2 pixels of where the median
+  // shift of the nearest features (up to 16 pixels away) moves them
+  std::vector<int> dxs, dys;
+  for (size_t i = 0; i < features.size(); i++) {
+    int best = 16 * 16 + 1, dx = 0, dy = 0;
+    for (size_t j = 0; j < nextFeatures.size(); j++) {
+      const int x = nextFeatures[j].x - features[i].x;
+      const int y = nextFeatures[j].y - features[i].y;
+      if (x * x + y * y < best) best = x * x + y * y, dx = x, dy = y;
+    }
+    if (best <= 16 * 16) dxs.push_back(dx), dys.push_back(dy);
+  }
+  if (dxs.empty()) return 0;
+  std::nth_element(dxs.begin(), dxs.begin() + dxs.size() / 2, dxs.end());
+  std::nth_element(dys.begin(), dys.begin() + dys.size() / 2, dys.end());
+  const int shiftX = dxs[dxs.size() / 2];
+  const int shiftY = dys[dys.size() / 2];
+
+  int repeated = 0;
+  for (size_t i = 0; i < features.size(); i++) {
+    for (size_t j = 0; j < nextFeatures.size(); j++) {
+      const int x = nextFeatures[j].x - features[i].x - shiftX;
+      const int y = nextFeatures[j].y - features[i].y - shiftY;
+      if (x * x + y * y <= 2 * 2) { repeated++; break; }
+    }
+  }
+  return repeated;
+}
+
+int countFastMismatches(R2Image& frame) {
+  // Pixels the selected instruction set scores differently from scalar code
+  R2LuminanceImage luminance(frame);
+  luminance.Blur(R2_FAST_DEFAULT_SIGMA, false);
+  R2PlanarImage scalar(luminance.Width(), luminance.Height(), 1);
+  R2PlanarImage vector(luminance.Width(), luminance.Height(), 1);
+  const R2FastInstructionSet instructionSet = R2FastGetInstructionSet();
+  R2FastSetInstructionSet(R2_FAST_SCALAR);
+  R2FastScorePlane(luminance.Plane(0), luminance.Width(), luminance.Height(), luminance.Stride(), R2_FAST_DEFAULT_ARC, R2_FAST_DEFAULT_THRESHOLD, scalar.Plane(0));
+  R2FastSetInstructionSet(instructionSet);
+  R2FastScorePlane(luminance.Plane(0), luminance.Width(), luminance.Height(), luminance.Stride(), R2_FAST_DEFAULT_ARC, R2_FAST_DEFAULT_THRESHOLD, vector.Plane(0));
+
+  int mismatches = 0;
+  for (int y = 0; y < luminance.Height(); y++) {
+    for (int x = 0; x < luminance.Width(); x++) {
+      if (scalar.Value(0, x, y) != vector.Value(0, x, y)) mismatches++;
+    }
+  }
+  return mismatches;
+}
+
+int countFeatureCells(const std::vector<Feature>& features) {
+  // How many 200 pixel cells of the frame the features are spread over
+  std::vector<std::pair<int, int> > cells;
+  for (size_t i = 0; i < features.size(); i++) cells.push_back(std::make_pair(features[i].x / 200, features[i].y / 200));
+  std::sort(cells.begin(), cells.end());
+  return std::unique(cells.begin(), cells.end()) - cells.begin();
+}
+
+void testFeatureDetectors(std::vector<std::string> &inputImageNames, bool scaleInvariant, bool octaves, bool anms) {
+  // Time Harris and FAST features on every frame and count how many of them the
+  // next frame repeats, and check FAST scores the same with every instruction set
+  // (scale invariant detection is Harris only, optionally over octaves), and
+  // how many 200 pixel cells they cover (more with ANMS)
+  const char *names[2] = { "Harris", "FAST" };
+  const int numDetectors = (scaleInvariant) ? 1 : 2;
+  std::vector<Feature> previousFeatures[2];
+  int times[2] = { 0, 0 };
+  int repeated[2] = { 0, 0 };
+  int compared[2] = { 0, 0 };
+  int cells[2] = { 0, 0 };
+  int mismatches = 0;
+  R2Image frame;
+  frame.setScaleSpaceOctaves(octaves);
+  frame.setFeatureANMS(anms);
+  Timer timer;
+  for (size_t i = 0; i < inputImageNames.size(); i++) {
+    if (!frame.Read(inputImageNames[i].c_str())) {
+      fprintf(stderr, "Unable to read image from %s\n", inputImageNames[i].c_str());
+      exit(-1);
+    }
+
+    printf("Frame %d:", (int) i + 1);
+    for (int d = 0; d < numDetectors; d++) {
+      std::vector<Feature> features;
+      frame.setFeatureFAST(d == 1);
+      timer.start();
+      frame.findFeatures(150, 10, scaleInvariant, frame, features);
+      const int time = timer.elapsedTime();
+      times[d] += time;
+      const int covered = countFeatureCells(features);
+      cells[d] += covered;
+      printf(" %s %lu features in %d cells %d ms", names[d], features.size(), covered, time);
+      if (i > 0) {
+        const int count = countRepeatedFeatures(previousFeatures[d], features);
+        repeated[d] += count;
+        compared[d] += previousFeatures[d].size();
+        printf(" (%d repeated)", count);
+      }
+      previousFeatures[d].swap(features);
+    }
+    if (numDetectors > 1) mismatches += countFastMismatches(frame);
+    printf("\n");
+  }
+  frame.setFeatureFAST(false);
+  frame.setScaleSpaceOctaves(false);
+  frame.setFeatureANMS(false);
+
+  for (int d = 0; d < numDetectors; d++) {
+    printf("%s: %d ms, %.1f cells a frame, %.1f%% of features repeated in the next frame\n", names[d], times[d],
+      (inputImageNames.size() > 0) ? (double) cells[d] / inputImageNames.size() : 0.0, (compared[d] > 0) ? 100.0 * repeated[d] / compared[d] : 0.0);
+  }
+  if (numDetectors > 1) printf("FAST %s vs scalar: %d pixels scored differently\n", R2FastInstructionSetName(R2FastGetInstructionSet()), mismatches);
+}
+
+void testFeatureMatching(std::vector<std::string> &inputImageNames, bool brief, bool verify) {
+  // Time matching the features of every frame to the next one (by ssd, or by
+  // BRIEF descriptor) and count how many matches RANSAC verifies, optionally
+  // checking coarse to fine ssd matches against the exhaustive search. Frames are
+  // read again for every pair, ssd matching marks the pixels it searched.
+  const char *name = (brief) ? "BRIEF" : "ssd";
+  int totalTime = 0;
+  int totalMatches = 0;
+  int totalInliers = 0;
+  R2Image frame, nextFrame;
+  frame.setFeatureBRIEF(brief);
+  frame.setFeatureMatchVerify(verify);
+  Timer timer;
+  for (size_t i = 0; i + 1 < inputImageNames.size(); i++) {
+    if (!frame.Read(inputImageNames[i].c_str()) || !nextFrame.Read(inputImageNames[i + 1].c_str())) {
+      fprintf(stderr, "Unable to read images from %s\n", inputImageNames[i].c_str());
+      exit(-1);
+    }
+
+    std::vector<FeatureMatch> matches;
+    timer.start();
+    nextFrame.findMatches(150, 150, frame, matches);
+    const int time = timer.elapsedTime();
+    nextFrame.classifyMatchesWithDltRANSAC(matches);
+    int inliers = 0;
+    for (size_t m = 0; m < matches.size(); m++) {
+      if (matches[m].verifiedMatch) inliers++;
+    }
+    printf("Frames %d-%d: %s %lu matches %d ms (%d RANSAC inliers)\n", (int) i + 1, (int) i + 2, name, matches.size(), time, inliers);
+    totalTime += time;
+    totalMatches += matches.size();
+    totalInliers += inliers;
+  }
+  frame.setFeatureBRIEF(false);
+  frame.setFeatureMatchVerify(false);
+
+  const int numPairs = (inputImageNames.size() > 1) ? inputImageNames.size() - 1 : 0;
+  printf("%s: %d ms, %.1f matches and %.1f RANSAC inliers a frame pair\n", name, totalTime,
+    (numPairs > 0) ? (double) totalMatches / numPairs : 0.0, (numPairs > 0) ? (double) totalInliers / numPairs : 0.0);
+  if (verify) frame.printSSDStats(stdout);
+}
+
 void processImageSequence(int argc, char **argv, char *input_folder_name) {
   char *image_base_name = *argv; argv++, argc--;
   char *output_folder_name = *argv; argv++, argc--;
@@ -238,9 +460,51 @@ void processImageSequence(int argc, char **argv, char *input_folder_name) {
 
   if (debugMode) printf("Found %lu images \n", inputImageNames.size());
 
+  // Threading of the options that follow (-threadTest runs them both ways),
+  // whether markers are matched by NCC instead of ssd, how -featureTest
+  // detects features and how -matchTest matches them
+  bool multithreaded = false;
+  bool testThreadSpeeds = false;
+  bool normalized = false;
+  bool scaleInvariant = false;
+  bool octaves = false;
+  bool anms = false;
+  bool brief = false;
+  bool verify = false;
+
   // Parse arguments and perform operations
   while (argc > 0) {
-    if (!strcmp(*argv, "-harryPotterize")) {
+    if (!strcmp(*argv, "-threads")) {
+      argv++, argc--;
+      multithreaded = true;
+    } else if (!strcmp(*argv, "-threadTest")) {
+      argv++, argc--;
+      testThreadSpeeds = true;
+    } else if (!strcmp(*argv, "-ncc")) {
+      argv++, argc--;
+      normalized = true;
+    } else if (!strcmp(*argv, "-scaleInvariant")) {
+      argv++, argc--;
+      scaleInvariant = true;
+    } else if (!strcmp(*argv, "-octaves")) {
+      argv++, argc--;
+      octaves = true;
+    } else if (!strcmp(*argv, "-anms")) {
+      argv++, argc--;
+      anms = true;
+    } else if (!strcmp(*argv, "-featureTest")) {
+      argv++, argc--;
+      testFeatureDetectors(inputImageNames, scaleInvariant, octaves, anms);
+    } else if (!strcmp(*argv, "-brief")) {
+      argv++, argc--;
+      brief = true;
+    } else if (!strcmp(*argv, "-verify")) {
+      argv++, argc--;
+      verify = true;
+    } else if (!strcmp(*argv, "-matchTest")) {
+      argv++, argc--;
+      testFeatureMatching(inputImageNames, brief, verify);
+    } else if (!strcmp(*argv, "-harryPotterize")) {
       CheckOption(*argv, argc, 4);
       char* marker_folder_name = argv[1];
       char* marker_base_name = argv[2];
@@ -261,20 +525,8 @@ void processImageSequence(int argc, char **argv, char *input_folder_name) {
       // }
       // return;
 
-      // test single vs multithread
-      bool testThreadSpeeds = false;
-      if (testThreadSpeeds) {
-        // Single thread test
-        printf("Single thread:\n");
-        harryPotterizeSequence(inputImageNames, outputImageNames, inputInnerImageNames, markerImages, false);
-
-        // Multi thread test
-        printf("Multi thread:\n");
-        harryPotterizeSequence(inputImageNames, outputImageNames, inputInnerImageNames, markerImages, true);
-      } else {
-        // do the magic
-        harryPotterizeSequence(inputImageNames, outputImageNames, inputInnerImageNames, markerImages, false);
-      }
+      // single thread, multithread, or both to compare
+      runHarryPotterizeSequence(inputImageNames, outputImageNames, inputInnerImageNames, markerImages, multithreaded, normalized, testThreadSpeeds);
     } else if (!strcmp(*argv, "-harryPotterizeImage")) {
       CheckOption(*argv, argc, 4);
       char* marker_folder_name = argv[1];
@@ -291,20 +543,8 @@ void processImageSequence(int argc, char **argv, char *input_folder_name) {
       if (debugMode) printf("Found %lu marker images\n", markerImages.size());    
 
 
-      // test single vs multithread
-      bool testThreadSpeeds = false;
-      if (testThreadSpeeds) {
-        // Single thread test
-        printf("Single thread:\n");
-        harryPotterizeSequence(inputImageNames, outputImageNames, inputInnerImageNames, markerImages, false);
-
-        // Multi thread test
-        printf("Multi thread:\n");
-        harryPotterizeSequence(inputImageNames, outputImageNames, inputInnerImageNames, markerImages, true);
-      } else {
-        // do the magic
-        harryPotterizeSequence(inputImageNames, outputImageNames, inputInnerImageNames, markerImages, false);
-      }
+      // single thread, multithread, or both to compare
+      runHarryPotterizeSequence(inputImageNames, outputImageNames, inputInnerImageNames, markerImages, multithreaded, normalized, testThreadSpeeds);
     }
 
     else {
@@ -336,6 +576,10 @@ main(int argc, char **argv)
 	      image->testDLT();
 	      return 0;
       }
+      if (!strcmp(argv[i], "-blurTest")) {
+        R2BlurPrintAccuracyReport(stdout);
+        return 0;
+      }
     }
 
   // Read input filename